@@ -0,0 +1,3412 @@
+/*
+ * libfree - the memory sampling behind free(1), see libfree.h
+ * 
+ * One backend per platform, selected at build time: sampler_init()
+ * resolves the static values, sampler_sample() reads the rest.
+ * 
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/types.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "libfree.h"
+
+/* sysctl not available on illumos/Solaris or Haiku */
+#if !defined(__sun) && !defined(__illumos__) && !defined(__HAIKU__)
+#include <sys/sysctl.h>
+#endif
+
+#ifdef __FreeBSD__
+#include <vm/vm_param.h>
+#include <sys/devicestat.h>
+#endif
+
+#ifdef __NetBSD__
+#include <uvm/uvm_extern.h>
+#include <sys/swap.h>
+#include <sys/iostat.h>
+#endif
+
+#ifdef __OpenBSD__
+#include <uvm/uvmexp.h>
+#include <sys/swap.h>
+#include <sys/disk.h>
+#endif
+
+#if defined(__NetBSD__) || defined(__OpenBSD__)
+#include <sys/param.h>
+#endif
+
+#ifdef __DragonFly__
+#include <sys/vmmeter.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/vm_statistics.h>
+#include <mach/mach_host.h>
+#endif
+
+#if defined(__sun) || defined(__illumos__)
+#include <kstat.h>
+#include <sys/swap.h>
+#include <sys/param.h>
+#endif
+
+#ifdef __HAIKU__
+#include <OS.h>
+#endif
+
+#if defined(__FreeBSD__) || defined(__sun) || defined(__illumos__)
+#include <pthread.h>
+#endif
+
+/*
+ * Kernel entry points used by the samplers, wrapped so --bench can
+ * report how many calls one sample costs. The macros are defined after
+ * every system header, so only the sampling code below goes through
+ * them; a function-like macro does not expand inside itself.
+ */
+static unsigned long bench_syscalls;
+
+unsigned long sampler_kernel_calls(void) {
+    return bench_syscalls;
+}
+
+#define BENCH_COUNT(call) (bench_syscalls++, call)
+#if !defined(__sun) && !defined(__illumos__) && !defined(__HAIKU__)
+#define sysctl(...) BENCH_COUNT(sysctl(__VA_ARGS__))
+#define sysctlbyname(...) BENCH_COUNT(sysctlbyname(__VA_ARGS__))
+#endif
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__APPLE__)
+#define sysctlnametomib(...) BENCH_COUNT(sysctlnametomib(__VA_ARGS__))
+#endif
+#ifdef __FreeBSD__
+#define devname(...) BENCH_COUNT(devname(__VA_ARGS__))
+#endif
+#if defined(__NetBSD__) || defined(__OpenBSD__) || defined(__sun) || defined(__illumos__)
+#define swapctl(...) BENCH_COUNT(swapctl(__VA_ARGS__))
+#endif
+#ifdef __APPLE__
+#define host_statistics64(...) BENCH_COUNT(host_statistics64(__VA_ARGS__))
+#define mach_host_self() BENCH_COUNT(mach_host_self())
+#endif
+#if defined(__sun) || defined(__illumos__)
+#define kstat_open() BENCH_COUNT(kstat_open())
+#define kstat_read(...) BENCH_COUNT(kstat_read(__VA_ARGS__))
+#define kstat_chain_update(...) BENCH_COUNT(kstat_chain_update(__VA_ARGS__))
+#endif
+#ifdef __HAIKU__
+#define get_system_info(...) BENCH_COUNT(get_system_info(__VA_ARGS__))
+#endif
+
+/*
+ * Failures are reported, never fatal, since the caller may be a
+ * long-lived agent. Code that cannot go on records what it was doing
+ * with fail() and returns -1 with errno set; sampler_open() and
+ * sampler_sample() hand that to the caller, and sampler_error() says
+ * what failed. Thread-local, so the --deadline workers and callers
+ * sampling on several threads each keep their own.
+ */
+static _Thread_local char fail_what[128];
+
+static int fail(int error, const char *fmt, ...) {
+    va_list ap;
+    
+    va_start(ap, fmt);
+    vsnprintf(fail_what, sizeof(fail_what), fmt, ap);
+    va_end(ap);
+    errno = error;
+    return -1;
+}
+
+const char *sampler_error(void) {
+    return fail_what;
+}
+
+const char *const libfree_source_names[SOURCE_COUNT] = { "vm", "cache", "swap" };
+
+const char *const libfree_cap_names[CAP_COUNT] = {
+    "swap", "swap-devices", "swap-totals", "paging", "zfs-arc",
+    "cache-count", "bufspace", "committed", "darwin-detail", "pressure",
+    "parallel", "snapshot", "swap-io"
+};
+
+/*
+ * Raw counters
+ * 
+ * A backend's live half only talks to the kernel: every counter it
+ * needs goes into a raw_sample_t under the backend's own index, in the
+ * kernel's units (pages, blocks, bytes), and sampler_sample() hands
+ * the set to the backend's *_compute(). The compute functions turn raw
+ * counters into a mem_stats_t with plain arithmetic and no system
+ * header, so all of them are built on every platform. That is what
+ * lets a fixture recorded on one OS replay on any other, and lets the
+ * --deadline workers return counters that the sampling thread merges
+ * and computes.
+ * 
+ * A counter that was not read has its present bit clear and counts as
+ * 0; a compute function only checks the bit where an absent source
+ * means something other than an empty one.
+ */
+#define RAW_MAX 32
+
+typedef struct {
+    uint64_t v[RAW_MAX];
+    uint32_t present;       /* bit i set if v[i] was read */
+} raw_sample_t;
+
+#define RAW_HAS(raw, i) (((raw)->present >> (i)) & 1u)
+
+/* Counters first..last, for the sources' masks */
+#define RAW_RANGE(first, last) ((2u << (last)) - (1u << (first)))
+
+static void raw_set(raw_sample_t *raw, int i, uint64_t value) {
+    raw->v[i] = value;
+    raw->present |= 1u << i;
+}
+
+/* The ARC_NBASE arcstats that mem_arc_pinned() needs are kept in ARC_* order */
+#define RAW_ARC_NAMES "arc_size", "arc_c_min", \
+    "arc_mru_evictable_data", "arc_mru_evictable_metadata", \
+    "arc_mfu_evictable_data", "arc_mfu_evictable_metadata"
+
+static void raw_arc(const raw_sample_t *raw, int first, arc_stats_t *arc) {
+    memset(arc, 0, sizeof(*arc));
+    for (int i = 0; i < ARC_NBASE; i++) {
+        if (RAW_HAS(raw, first + i)) {
+            arc->v[i] = raw->v[first + i];
+            arc->present |= 1u << i;
+        }
+    }
+}
+
+/*
+ * ARC bytes that memory pressure cannot take back. The ARC never
+ * shrinks below c_min, and only buffers on the evictable MRU/MFU lists
+ * can go at all; headers, dbufs and in-flight data stay. Kernels that
+ * do not export the evictable sizes only get the c_min floor.
+ */
+uint64_t mem_arc_pinned(const arc_stats_t *arc) {
+    const uint32_t evict = 1u << ARC_MRU_EVICT_DATA | 1u << ARC_MRU_EVICT_META |
+                           1u << ARC_MFU_EVICT_DATA | 1u << ARC_MFU_EVICT_META;
+    uint64_t size = arc->v[ARC_SIZE];
+    uint64_t reclaimable = size;
+    
+    if (arc->present & (1u << ARC_C_MIN)) {
+        reclaimable = size > arc->v[ARC_C_MIN] ? size - arc->v[ARC_C_MIN] : 0;
+    }
+    if ((arc->present & evict) == evict) {
+        uint64_t evictable = arc->v[ARC_MRU_EVICT_DATA] + arc->v[ARC_MRU_EVICT_META] +
+                             arc->v[ARC_MFU_EVICT_DATA] + arc->v[ARC_MFU_EVICT_META];
+        if (evictable < reclaimable) {
+            reclaimable = evictable;
+        }
+    }
+    return size - reclaimable;
+}
+
+/*
+ * FreeBSD: vm.stats.vm counters and vm.swap_info blocks are in pages,
+ * the arcstats, vfs.bufspace and vm.swap_reserved in bytes
+ */
+enum {
+    FREEBSD_PAGE_SIZE,
+    FREEBSD_PAGE_COUNT,
+    FREEBSD_FREE_COUNT,
+    FREEBSD_ACTIVE_COUNT,
+    FREEBSD_INACTIVE_COUNT,
+    FREEBSD_WIRE_COUNT,
+    FREEBSD_LAUNDRY_COUNT,
+    FREEBSD_FREE_TARGET,
+    FREEBSD_ARC,                /* ARC_NBASE arcstats */
+    FREEBSD_CACHE_COUNT = FREEBSD_ARC + ARC_NBASE,
+    FREEBSD_BUFSPACE,
+    FREEBSD_SWAP_NBLKS,         /* summed over the swap devices */
+    FREEBSD_SWAP_USED,
+    FREEBSD_SWAPPGSIN,
+    FREEBSD_SWAPPGSOUT,
+    FREEBSD_SWAP_RESERVED,      /* SAMPLER_COMMIT only */
+    FREEBSD_FREE_RESERVED,
+    FREEBSD_OVERCOMMIT,
+    FREEBSD_NRAW
+};
+
+static const char *const freebsd_raw[FREEBSD_NRAW] = {
+    "page_size", "page_count", "free_count", "active_count", "inactive_count",
+    "wire_count", "laundry_count", "free_target", RAW_ARC_NAMES,
+    "cache_count", "bufspace", "swap_nblks", "swap_used", "swappgsin", "swappgsout",
+    "swap_reserved", "free_reserved", "overcommit"
+};
+
+static void freebsd_compute(const raw_sample_t *raw, mem_stats_t *stats) {
+    const uint64_t *v = raw->v;
+    uint64_t page_size = v[FREEBSD_PAGE_SIZE];
+    arc_stats_t arc;
+    
+    stats->mem_total = v[FREEBSD_PAGE_COUNT] * page_size;
+    stats->mem_free = v[FREEBSD_FREE_COUNT] * page_size;
+    stats->mem_active = v[FREEBSD_ACTIVE_COUNT] * page_size;
+    stats->mem_inactive = v[FREEBSD_INACTIVE_COUNT] * page_size;
+    stats->mem_wired = v[FREEBSD_WIRE_COUNT] * page_size;
+    /* Dirty pages waiting for a pageout */
+    stats->mem_laundry = v[FREEBSD_LAUNDRY_COUNT] * page_size;
+    stats->free_target = v[FREEBSD_FREE_TARGET] * page_size;
+    stats->has_estimate_info = ESTIMATE_LAUNDRY;
+    if (stats->free_target > 0) {
+        stats->has_estimate_info |= ESTIMATE_FREE_TARGET;
+    }
+    
+    /*
+     * On FreeBSD systems with ZFS the ARC is the primary cache and can
+     * use gigabytes; bufspace is then small and part of it. Without
+     * ZFS the traditional cache count is all reclaimable.
+     */
+    raw_arc(raw, FREEBSD_ARC, &arc);
+    if (arc.v[ARC_SIZE] > 0) {
+        stats->mem_cache = arc.v[ARC_SIZE];
+        stats->arc_pinned = mem_arc_pinned(&arc);
+        stats->has_estimate_info |= ESTIMATE_ARC_PINNED;
+        stats->mem_buffers = 0;
+    } else {
+        stats->mem_cache = v[FREEBSD_CACHE_COUNT] * page_size;
+        stats->arc_pinned = 0;
+        stats->mem_buffers = v[FREEBSD_BUFSPACE];
+    }
+    
+    stats->swap_total = v[FREEBSD_SWAP_NBLKS] * page_size;
+    stats->swap_used = v[FREEBSD_SWAP_USED] * page_size;
+    stats->has_swap_info = 1;
+    /* v_swappgsin/v_swappgsout count pages; both or neither are reported */
+    if (RAW_HAS(raw, FREEBSD_SWAPPGSIN) && RAW_HAS(raw, FREEBSD_SWAPPGSOUT)) {
+        stats->swap_in = v[FREEBSD_SWAPPGSIN] * page_size;
+        stats->swap_out = v[FREEBSD_SWAPPGSOUT] * page_size;
+        stats->has_paging_info |= PAGING_SWAP;
+    }
+    
+    /*
+     * vm.swap_reserved is every byte of anonymous memory charged so far.
+     * The kernel only refuses new reservations with
+     * SWAP_RESERVE_FORCE_ON (bit 0 of vm.overcommit); the limit is then
+     * swap plus, with bit 2, all RAM that is neither wired nor in the
+     * free reserve. See swap_reserve().
+     */
+    if (RAW_HAS(raw, FREEBSD_SWAP_RESERVED)) {
+        uint64_t overcommit = v[FREEBSD_OVERCOMMIT];
+        
+        stats->committed = v[FREEBSD_SWAP_RESERVED];
+        stats->has_commit_info |= COMMIT_RESERVED;
+        if (overcommit & 0x01) {
+            stats->commit_limit = stats->swap_total;
+            if ((overcommit & 0x04) && RAW_HAS(raw, FREEBSD_FREE_RESERVED)) {
+                uint64_t other = v[FREEBSD_FREE_RESERVED] * page_size + stats->mem_wired;
+                stats->commit_limit += stats->mem_total > other ? stats->mem_total - other : 0;
+            }
+            stats->has_commit_info |= COMMIT_LIMIT;
+        }
+    }
+}
+
+/*
+ * Per-sample sanity for the UVM backends
+ * The kernel copies uvmexp out without taking a lock, so under load a
+ * page that moves between queues during the copy can be counted in two
+ * of them or in neither. Clamp the sample to a state the machine could
+ * have been in: free and wired within the managed pages, the four
+ * queues adding up to at most those (the excess comes off inactive,
+ * then active, where pages are in transit), cache never more than what
+ * is not free, and swap in use within the swap configured.
+ */
+static void uvm_clamp(mem_stats_t *stats, uint64_t managed) {
+    uint64_t sum, excess;
+    
+    if (stats->mem_free > managed) {
+        stats->mem_free = managed;
+    }
+    if (stats->mem_wired > managed - stats->mem_free) {
+        stats->mem_wired = managed - stats->mem_free;
+    }
+    
+    sum = stats->mem_free + stats->mem_wired + stats->mem_active + stats->mem_inactive;
+    if (sum > managed) {
+        excess = sum - managed;
+        if (excess > stats->mem_inactive) {
+            excess -= stats->mem_inactive;
+            stats->mem_inactive = 0;
+            stats->mem_active -= excess;
+        } else {
+            stats->mem_inactive -= excess;
+        }
+    }
+    if (stats->mem_cache > managed - stats->mem_free) {
+        stats->mem_cache = managed - stats->mem_free;
+    }
+    
+    if (stats->swap_used > stats->swap_total) {
+        stats->swap_used = stats->swap_total;
+    }
+    if (stats->swap_only > stats->swap_used) {
+        stats->swap_only = stats->swap_used;
+    }
+}
+
+/* NetBSD: uvmexp_sysctl fields, all in pages but pagesize */
+enum {
+    NETBSD_PAGESIZE,
+    NETBSD_NPAGES,
+    NETBSD_FREE,
+    NETBSD_ACTIVE,
+    NETBSD_INACTIVE,
+    NETBSD_WIRED,
+    NETBSD_FREETARG,
+    NETBSD_EXECPAGES,
+    NETBSD_FILEPAGES,
+    NETBSD_SWPAGES,
+    NETBSD_SWPGINUSE,
+    NETBSD_PGSWAPIN,
+    NETBSD_PGSWAPOUT,
+    NETBSD_ANONPAGES,           /* SAMPLER_COMMIT only */
+    NETBSD_SWPGONLY,
+    NETBSD_NRAW
+};
+
+static const char *const netbsd_raw[NETBSD_NRAW] = {
+    "pagesize", "npages", "free", "active", "inactive", "wired", "freetarg",
+    "execpages", "filepages", "swpages", "swpginuse", "pgswapin", "pgswapout",
+    "anonpages", "swpgonly"
+};
+
+static void netbsd_compute(const raw_sample_t *raw, mem_stats_t *stats) {
+    const uint64_t *v = raw->v;
+    uint64_t page_size = v[NETBSD_PAGESIZE];
+    
+    /*
+     * Use pages managed (npages) for total, not hw.physmem
+     * This matches NetBSD's /usr/pkg/bin/free which parses vmstat output
+     * Pages managed = total pages the kernel manages (excludes kernel reserved)
+     */
+    stats->mem_total = v[NETBSD_NPAGES] * page_size;
+    
+    /*
+     * NetBSD UVM page categories:
+     * - free: immediately available pages
+     * - active: recently accessed, likely to be used again
+     * - inactive: not recently used, candidates for reclamation
+     * - wired: locked in memory, cannot be paged out
+     * - execpages: executable code pages (cached)
+     * - filepages: file data pages (cached)
+     */
+    stats->mem_free = v[NETBSD_FREE] * page_size;
+    stats->mem_active = v[NETBSD_ACTIVE] * page_size;
+    stats->mem_inactive = v[NETBSD_INACTIVE] * page_size;
+    stats->mem_wired = v[NETBSD_WIRED] * page_size;
+    stats->free_target = v[NETBSD_FREETARG] * page_size;
+    stats->has_estimate_info = ESTIMATE_FREE_TARGET;
+    
+    /*
+     * File cache = executable pages + file data pages
+     * This matches NetBSD's /usr/pkg/bin/free which shows "buffers"
+     * as execpages + filepages
+     */
+    stats->mem_cache = (v[NETBSD_EXECPAGES] + v[NETBSD_FILEPAGES]) * page_size;
+    
+    /*
+     * vm.bufmem is metadata overhead for the buffer cache
+     * It's already accounted for in filepages, so we don't add it separately
+     * to avoid double-counting
+     */
+    stats->mem_buffers = 0;
+    
+    /* Swap statistics directly available in uvmexp */
+    stats->swap_total = v[NETBSD_SWPAGES] * page_size;
+    stats->swap_used = v[NETBSD_SWPGINUSE] * page_size;
+    
+    /* Pages moved to and from swap, from the same snapshot */
+    stats->swap_in = v[NETBSD_PGSWAPIN] * page_size;
+    stats->swap_out = v[NETBSD_PGSWAPOUT] * page_size;
+    stats->has_paging_info = PAGING_SWAP;
+    
+    /*
+     * UVM does not reserve swap for anonymous memory, so there is no
+     * limit. What is promised is what exists: anonymous pages in RAM
+     * plus those whose only copy is in swap. swpginuse also counts
+     * slots still backed by a RAM copy and already is swap_used.
+     */
+    if (RAW_HAS(raw, NETBSD_ANONPAGES)) {
+        stats->committed = (v[NETBSD_ANONPAGES] + v[NETBSD_SWPGONLY]) * page_size;
+        stats->swap_only = v[NETBSD_SWPGONLY] * page_size;
+        stats->has_commit_info = COMMIT_RESERVED | COMMIT_SWAPONLY;
+    }
+    uvm_clamp(stats, stats->mem_total);
+    stats->has_swap_info = 1;
+}
+
+/* OpenBSD: struct uvmexp fields in pages, hw.physmem64 in bytes */
+enum {
+    OPENBSD_PAGESIZE,
+    OPENBSD_PHYSMEM,            /* not with SAMPLER_SNAPSHOT */
+    OPENBSD_NPAGES,
+    OPENBSD_FREE,
+    OPENBSD_ACTIVE,
+    OPENBSD_INACTIVE,
+    OPENBSD_WIRED,
+    OPENBSD_FREETARG,
+    OPENBSD_SWPAGES,
+    OPENBSD_SWPGINUSE,
+    OPENBSD_PGSWAPIN,
+    OPENBSD_PGSWAPOUT,
+    OPENBSD_SWPGONLY,           /* SAMPLER_COMMIT only */
+    OPENBSD_NRAW
+};
+
+static const char *const openbsd_raw[OPENBSD_NRAW] = {
+    "pagesize", "physmem64", "npages", "free", "active", "inactive", "wired",
+    "freetarg", "swpages", "swpginuse", "pgswapin", "pgswapout", "swpgonly"
+};
+
+static void openbsd_compute(const raw_sample_t *raw, mem_stats_t *stats) {
+    const uint64_t *v = raw->v;
+    uint64_t page_size = v[OPENBSD_PAGESIZE];
+    uint64_t managed = v[OPENBSD_NPAGES] * page_size;
+    
+    /* Installed RAM, or the managed pages of the same snapshot */
+    stats->mem_total = RAW_HAS(raw, OPENBSD_PHYSMEM) ? v[OPENBSD_PHYSMEM] : managed;
+    
+    /*
+     * OpenBSD UVM page categories (similar to NetBSD):
+     * - free: immediately available pages
+     * - active: recently accessed, likely to be used again
+     * - inactive: not recently used, candidates for reclamation
+     * - wired: locked in memory, cannot be paged out
+     * - cache: buffer cache and other cached pages
+     */
+    stats->mem_free = v[OPENBSD_FREE] * page_size;
+    stats->mem_active = v[OPENBSD_ACTIVE] * page_size;
+    stats->mem_inactive = v[OPENBSD_INACTIVE] * page_size;
+    stats->mem_wired = v[OPENBSD_WIRED] * page_size;
+    stats->free_target = v[OPENBSD_FREETARG] * page_size;
+    stats->has_estimate_info = ESTIMATE_FREE_TARGET;
+    
+    /*
+     * Buffer memory not separately tracked on OpenBSD
+     * It's included in the cache calculation below
+     */
+    stats->mem_buffers = 0;
+    
+    /* Swap statistics directly available in uvmexp */
+    stats->swap_total = v[OPENBSD_SWPAGES] * page_size;
+    stats->swap_used = v[OPENBSD_SWPGINUSE] * page_size;
+    
+    /* Pages moved to and from swap, from the same snapshot */
+    stats->swap_in = v[OPENBSD_PGSWAPIN] * page_size;
+    stats->swap_out = v[OPENBSD_PGSWAPOUT] * page_size;
+    stats->has_paging_info = PAGING_SWAP;
+    
+    /*
+     * Like NetBSD, no swap reservation and no limit; OpenBSD's uvmexp
+     * has no anonymous page count either, only the swap-only pages
+     */
+    if (RAW_HAS(raw, OPENBSD_SWPGONLY)) {
+        stats->swap_only = v[OPENBSD_SWPGONLY] * page_size;
+        stats->has_commit_info = COMMIT_SWAPONLY;
+    }
+    
+    /*
+     * Calculate cache as remaining pages not accounted for
+     * OpenBSD's top uses: npages - free - active - inactive - wired
+     * This includes buffer cache, per-CPU caches, and other cached pages
+     * Note: vnodepages and vtextpages fields exist but are often 0
+     * After uvm_clamp() the four queues never exceed npages, so the
+     * residual cannot go negative.
+     */
+    uvm_clamp(stats, managed);
+    stats->mem_cache = managed - stats->mem_free - stats->mem_active -
+                       stats->mem_inactive - stats->mem_wired;
+    stats->has_swap_info = 1;
+}
+
+/* DragonFly: vm.stats.vm counters and vm.swap_* in pages, hw.physmem in bytes */
+enum {
+    DRAGONFLY_PAGESIZE,
+    DRAGONFLY_PHYSMEM,
+    DRAGONFLY_FREE_COUNT,
+    DRAGONFLY_ACTIVE_COUNT,
+    DRAGONFLY_INACTIVE_COUNT,
+    DRAGONFLY_WIRE_COUNT,
+    DRAGONFLY_CACHE_COUNT,
+    DRAGONFLY_FREE_TARGET,
+    DRAGONFLY_SWAPPGSIN,
+    DRAGONFLY_SWAPPGSOUT,
+    DRAGONFLY_SWAP_SIZE,        /* only once swap is configured */
+    DRAGONFLY_SWAP_FREE,
+    DRAGONFLY_NRAW
+};
+
+static const char *const dragonfly_raw[DRAGONFLY_NRAW] = {
+    "pagesize", "physmem", "free_count", "active_count", "inactive_count",
+    "wire_count", "cache_count", "free_target", "swappgsin", "swappgsout",
+    "swap_size", "swap_free"
+};
+
+static void dragonfly_compute(const raw_sample_t *raw, mem_stats_t *stats) {
+    const uint64_t *v = raw->v;
+    uint64_t page_size = v[DRAGONFLY_PAGESIZE];
+    
+    stats->mem_total = v[DRAGONFLY_PHYSMEM];
+    stats->mem_free = v[DRAGONFLY_FREE_COUNT] * page_size;
+    stats->mem_active = v[DRAGONFLY_ACTIVE_COUNT] * page_size;
+    stats->mem_inactive = v[DRAGONFLY_INACTIVE_COUNT] * page_size;
+    stats->mem_wired = v[DRAGONFLY_WIRE_COUNT] * page_size;
+    stats->mem_cache = v[DRAGONFLY_CACHE_COUNT] * page_size;
+    stats->free_target = v[DRAGONFLY_FREE_TARGET] * page_size;
+    stats->has_estimate_info = stats->free_target > 0 ?
+                               ESTIMATE_FREE_TARGET : 0;
+    
+    /* Buffer memory not directly accessible on DragonFly */
+    stats->mem_buffers = 0;
+    
+    if (RAW_HAS(raw, DRAGONFLY_SWAPPGSIN) && RAW_HAS(raw, DRAGONFLY_SWAPPGSOUT)) {
+        stats->swap_in = v[DRAGONFLY_SWAPPGSIN] * page_size;
+        stats->swap_out = v[DRAGONFLY_SWAPPGSOUT] * page_size;
+        stats->has_paging_info |= PAGING_SWAP;
+    }
+    
+    /* Swap might not be configured */
+    if (!RAW_HAS(raw, DRAGONFLY_SWAP_SIZE)) {
+        stats->swap_total = 0;
+        stats->swap_used = 0;
+        return;
+    }
+    stats->swap_total = v[DRAGONFLY_SWAP_SIZE] * page_size;
+    stats->swap_used = v[DRAGONFLY_SWAP_SIZE] > v[DRAGONFLY_SWAP_FREE] ?
+                       (v[DRAGONFLY_SWAP_SIZE] - v[DRAGONFLY_SWAP_FREE]) * page_size : 0;
+    stats->has_swap_info = 1;
+}
+
+/* macOS: vm_statistics64 counts in pages, hw.memsize and xsw_usage in bytes */
+enum {
+    DARWIN_PAGESIZE,
+    DARWIN_MEMSIZE,
+    DARWIN_FREE_COUNT,
+    DARWIN_ACTIVE_COUNT,
+    DARWIN_INACTIVE_COUNT,
+    DARWIN_WIRE_COUNT,
+    DARWIN_SPECULATIVE_COUNT,
+    DARWIN_PURGEABLE_COUNT,
+    DARWIN_EXTERNAL_PAGE_COUNT,
+    DARWIN_FREE_TARGET,
+    DARWIN_SWAPINS,
+    DARWIN_SWAPOUTS,
+    DARWIN_PAGEINS,
+    DARWIN_PAGEOUTS,
+    DARWIN_COMPRESSIONS,
+    DARWIN_XSU_TOTAL,           /* only when vm.swapusage answers */
+    DARWIN_XSU_USED,
+    DARWIN_NRAW
+};
+
+static const char *const darwin_raw[DARWIN_NRAW] = {
+    "pagesize", "memsize", "free_count", "active_count", "inactive_count",
+    "wire_count", "speculative_count", "purgeable_count", "external_page_count",
+    "page_free_target", "swapins", "swapouts", "pageins", "pageouts",
+    "compressions", "xsu_total", "xsu_used"
+};
+
+static void darwin_compute(const raw_sample_t *raw, mem_stats_t *stats) {
+    const uint64_t *v = raw->v;
+    uint64_t pagesize = v[DARWIN_PAGESIZE];
+    
+    stats->mem_total = v[DARWIN_MEMSIZE];
+    
+    /*
+     * macOS page categories (from vm_statistics64):
+     * - free_count: immediately available pages
+     * - active_count: pages currently in use or recently used
+     * - inactive_count: pages not recently used, candidates for reclamation
+     * - wire_count: wired (locked) pages, cannot be paged out (kernel use)
+     * - speculative_count: pre-fetched pages (like cache)
+     * - purgeable_count: purgeable memory (can be freed instantly)
+     * - external_page_count: file-backed pages (app code/mapped files)
+     */
+    stats->mem_free = v[DARWIN_FREE_COUNT] * pagesize;
+    stats->mem_active = v[DARWIN_ACTIVE_COUNT] * pagesize;
+    stats->mem_inactive = v[DARWIN_INACTIVE_COUNT] * pagesize;
+    stats->mem_wired = v[DARWIN_WIRE_COUNT] * pagesize;
+    stats->free_target = v[DARWIN_FREE_TARGET] * pagesize;
+    stats->has_estimate_info = stats->free_target > 0 ?
+                               ESTIMATE_FREE_TARGET : 0;
+    
+    /*
+     * Cache = speculative + purgeable pages
+     * These are reclaimable without needing to page out to disk
+     */
+    stats->mem_cache = (v[DARWIN_SPECULATIVE_COUNT] + v[DARWIN_PURGEABLE_COUNT]) * pagesize;
+    
+    /*
+     * File-backed pages (external) could be considered as "buffers"
+     * These are pages backed by files on disk (app code, mapped files)
+     */
+    stats->mem_buffers = v[DARWIN_EXTERNAL_PAGE_COUNT] * pagesize;
+    
+    /*
+     * pageins/pageouts include file-backed traffic; swapins/swapouts
+     * are compressor segments going to and from the swap files
+     */
+    stats->swap_in = v[DARWIN_SWAPINS] * pagesize;
+    stats->swap_out = v[DARWIN_SWAPOUTS] * pagesize;
+    stats->page_in = v[DARWIN_PAGEINS] * pagesize;
+    stats->page_out = v[DARWIN_PAGEOUTS] * pagesize;
+    stats->compressions = v[DARWIN_COMPRESSIONS] * pagesize;
+    stats->has_paging_info = PAGING_SWAP | PAGING_FILE | PAGING_COMPRESS;
+    
+    /* Compressed memory doesn't necessarily use swap space */
+    stats->swap_total = v[DARWIN_XSU_TOTAL];
+    stats->swap_used = v[DARWIN_XSU_USED];
+    stats->has_swap_info = RAW_HAS(raw, DARWIN_XSU_TOTAL);
+}
+
+/*
+ * illumos: unix:0:system_pages and the anon/swap figures in pages, the
+ * arcstats in bytes. The swap totals are SC_AINFO's, or the sums over
+ * SC_LIST when the devices are listed.
+ */
+enum {
+    ILLUMOS_PAGESIZE,
+    ILLUMOS_PHYSMEM,
+    ILLUMOS_FREEMEM,
+    ILLUMOS_PP_KERNEL,
+    ILLUMOS_LOTSFREE,
+    ILLUMOS_ARC,                /* ARC_NBASE arcstats */
+    ILLUMOS_SWAP_PAGES = ILLUMOS_ARC + ARC_NBASE,
+    ILLUMOS_SWAP_FREE,
+    ILLUMOS_ANI_RESV,           /* SAMPLER_COMMIT only */
+    ILLUMOS_ANI_MAX,
+    ILLUMOS_NRAW
+};
+
+static const char *const illumos_raw[ILLUMOS_NRAW] = {
+    "pagesize", "physmem", "freemem", "pp_kernel", "lotsfree", RAW_ARC_NAMES,
+    "swap_pages", "swap_free", "ani_resv", "ani_max"
+};
+
+static void illumos_compute(const raw_sample_t *raw, mem_stats_t *stats) {
+    const uint64_t *v = raw->v;
+    uint64_t page_size = v[ILLUMOS_PAGESIZE];
+    arc_stats_t arc;
+    
+    /*
+     * - physmem: total physical memory pages
+     * - freemem: free memory pages
+     * - pp_kernel: pages used by kernel (locked)
+     * The page scanner starts once freemem drops below lotsfree.
+     */
+    stats->mem_total = v[ILLUMOS_PHYSMEM] * page_size;
+    stats->mem_free = v[ILLUMOS_FREEMEM] * page_size;
+    stats->free_target = v[ILLUMOS_LOTSFREE] * page_size;
+    stats->has_estimate_info = stats->free_target > 0 ?
+                               ESTIMATE_FREE_TARGET : 0;
+    stats->mem_wired = v[ILLUMOS_PP_KERNEL] * page_size;
+    
+    /* Simplified: active/inactive not easily available */
+    stats->mem_active = 0;
+    stats->mem_inactive = 0;
+    
+    /* On illumos, ZFS ARC is the primary cache mechanism */
+    raw_arc(raw, ILLUMOS_ARC, &arc);
+    stats->mem_cache = arc.v[ARC_SIZE];
+    if (arc.v[ARC_SIZE] > 0) {
+        stats->arc_pinned = mem_arc_pinned(&arc);
+        stats->has_estimate_info |= ESTIMATE_ARC_PINNED;
+    } else {
+        stats->arc_pinned = 0;
+    }
+    stats->mem_buffers = 0;
+    
+    if (RAW_HAS(raw, ILLUMOS_SWAP_PAGES)) {
+        stats->swap_total = v[ILLUMOS_SWAP_PAGES] * page_size;
+        stats->swap_used = v[ILLUMOS_SWAP_PAGES] > v[ILLUMOS_SWAP_FREE] ?
+                           (v[ILLUMOS_SWAP_PAGES] - v[ILLUMOS_SWAP_FREE]) * page_size : 0;
+        stats->has_swap_info = 1;
+    } else {
+        stats->swap_total = 0;
+        stats->swap_used = 0;
+    }
+    
+    /*
+     * Virtual swap is the commit accounting: every anonymous page
+     * reserves ani_resv when it is mapped, and reservations fail past
+     * ani_max
+     */
+    if (RAW_HAS(raw, ILLUMOS_ANI_RESV)) {
+        stats->committed = v[ILLUMOS_ANI_RESV] * page_size;
+        stats->commit_limit = v[ILLUMOS_ANI_MAX] * page_size;
+        stats->has_commit_info = COMMIT_RESERVED | COMMIT_LIMIT;
+    }
+}
+
+/* Haiku: system_info page counts, needed_memory and free_memory in bytes */
+enum {
+    HAIKU_PAGE_SIZE,
+    HAIKU_MAX_PAGES,
+    HAIKU_USED_PAGES,
+    HAIKU_CACHED_PAGES,
+    HAIKU_NEEDED_MEMORY,        /* SAMPLER_COMMIT only */
+    HAIKU_FREE_MEMORY,
+    HAIKU_NRAW
+};
+
+static const char *const haiku_raw[HAIKU_NRAW] = {
+    "page_size", "max_pages", "used_pages", "cached_pages", "needed_memory", "free_memory"
+};
+
+static void haiku_compute(const raw_sample_t *raw, mem_stats_t *stats) {
+    const uint64_t *v = raw->v;
+    uint64_t page_size = v[HAIKU_PAGE_SIZE];
+    uint64_t used_and_cached = v[HAIKU_USED_PAGES] + v[HAIKU_CACHED_PAGES];
+    
+    /*
+     * Memory calculation:
+     * - total = max_pages (total physical RAM)
+     * - active (used by apps) = used_pages
+     * - cache = cached_pages (file cache, reclaimable)
+     * - free = max_pages - used_pages - cached_pages
+     *
+     * Note: On Haiku, used_pages and cached_pages are mutually exclusive,
+     * unlike other systems where cache might be included in used.
+     */
+    stats->mem_total = v[HAIKU_MAX_PAGES] * page_size;
+    stats->mem_active = v[HAIKU_USED_PAGES] * page_size;
+    stats->mem_cache = v[HAIKU_CACHED_PAGES] * page_size;
+    stats->mem_free = used_and_cached < v[HAIKU_MAX_PAGES] ?
+                      (v[HAIKU_MAX_PAGES] - used_and_cached) * page_size : 0;
+    
+    /* Haiku doesn't expose these separately */
+    stats->mem_inactive = 0;
+    stats->mem_wired = 0;
+    stats->mem_buffers = 0;
+    
+    /*
+     * Haiku doesn't use traditional swap in the same way
+     * It has virtual memory but not exposed the same way
+     */
+    stats->swap_total = 0;
+    stats->swap_used = 0;
+    stats->has_swap_info = 0;  /* Don't display swap line on Haiku */
+    
+    /*
+     * needed_memory is what the VM has reserved for commitments and
+     * free_memory what it can still reserve, so together they are the
+     * limit at which reservations start to fail
+     */
+    if (RAW_HAS(raw, HAIKU_NEEDED_MEMORY)) {
+        stats->committed = v[HAIKU_NEEDED_MEMORY];
+        stats->commit_limit = v[HAIKU_NEEDED_MEMORY] + v[HAIKU_FREE_MEMORY];
+        stats->has_commit_info = COMMIT_RESERVED | COMMIT_LIMIT;
+    }
+}
+
+/*
+ * Default reclaim weights, RECLAIM_* order (free, inactive, laundry,
+ * cache, buffers). Laundry is dirty by definition and counts nothing
+ * anywhere; the rest follows how each kernel gets the class back.
+ * 
+ * FreeBSD: the page daemon frees clean inactive pages on the spot and
+ * moves dirty ones to the laundry queue, so what is left inactive is
+ * cheap. The ARC only shrinks from its own eviction thread once
+ * vm_lowmem fires, so it counts half. Buffer pages stay wired until
+ * the buffer is released and are left out, as in available.
+ */
+#define WEIGHTS_FREEBSD     { 100, 100, 0, 50, 0 }
+/*
+ * DragonFly: v_cache pages are clean and taken straight off the queue
+ * by the page allocator. There is no laundry queue, so inactive still
+ * holds dirty pages that need a pageout first.
+ */
+#define WEIGHTS_DRAGONFLY   { 100, 50, 0, 100, 0 }
+/*
+ * NetBSD, OpenBSD: UVM file and exec pages include active, mapped ones
+ * that the page daemon has to deactivate first; inactive is left out
+ * as in available.
+ */
+#define WEIGHTS_UVM         { 100, 0, 0, 50, 0 }
+/*
+ * macOS: speculative and purgeable pages are dropped without I/O.
+ * Inactive anonymous pages go through the compressor first, and
+ * external pages include active ones.
+ */
+#define WEIGHTS_DARWIN      { 100, 50, 0, 100, 0 }
+/*
+ * illumos: freemem already includes the cache list, so that part is
+ * immediate. The ARC gives memory back from arc_reclaim_thread, not on
+ * demand.
+ */
+#define WEIGHTS_ILLUMOS     { 100, 0, 0, 50, 0 }
+#define WEIGHTS_GENERIC     { 100, 50, 0, 50, 0 }
+
+/*
+ * How samples of each backend are computed and derived. MODEL_NATIVE
+ * is the fallback for platforms without a backend of their own.
+ */
+typedef struct {
+    const char *name;               /* backend_t.name of the recording build */
+    const char *const *raw_names;   /* by raw counter index */
+    int nraw;
+    void (*compute)(const raw_sample_t *raw, mem_stats_t *stats);
+    int uvm;                        /* used is total - free, available free + cache */
+    unsigned int weights[RECLAIM_NCLASSES];
+} model_t;
+
+static const model_t models[MODEL_COUNT] = {
+    [MODEL_NATIVE] = { "unknown", NULL, 0, NULL, 0, WEIGHTS_GENERIC },
+    [MODEL_FREEBSD] = { "freebsd", freebsd_raw, FREEBSD_NRAW, freebsd_compute, 0,
+                        WEIGHTS_FREEBSD },
+    [MODEL_NETBSD] = { "netbsd", netbsd_raw, NETBSD_NRAW, netbsd_compute, 1, WEIGHTS_UVM },
+    [MODEL_OPENBSD] = { "openbsd", openbsd_raw, OPENBSD_NRAW, openbsd_compute, 1, WEIGHTS_UVM },
+    [MODEL_DRAGONFLY] = { "dragonfly", dragonfly_raw, DRAGONFLY_NRAW, dragonfly_compute, 0,
+                          WEIGHTS_DRAGONFLY },
+    [MODEL_DARWIN] = { "darwin", darwin_raw, DARWIN_NRAW, darwin_compute, 0, WEIGHTS_DARWIN },
+    [MODEL_ILLUMOS] = { "illumos", illumos_raw, ILLUMOS_NRAW, illumos_compute, 0,
+                        WEIGHTS_ILLUMOS },
+    [MODEL_HAIKU] = { "haiku", haiku_raw, HAIKU_NRAW, haiku_compute, 0, WEIGHTS_GENERIC },
+};
+
+/* This build's backend */
+#if defined(__FreeBSD__)
+#define MODEL_THIS      MODEL_FREEBSD
+#define WEIGHTS_THIS    WEIGHTS_FREEBSD
+#elif defined(__NetBSD__)
+#define MODEL_THIS      MODEL_NETBSD
+#define WEIGHTS_THIS    WEIGHTS_UVM
+#elif defined(__OpenBSD__)
+#define MODEL_THIS      MODEL_OPENBSD
+#define WEIGHTS_THIS    WEIGHTS_UVM
+#elif defined(__DragonFly__)
+#define MODEL_THIS      MODEL_DRAGONFLY
+#define WEIGHTS_THIS    WEIGHTS_DRAGONFLY
+#elif defined(__APPLE__)
+#define MODEL_THIS      MODEL_DARWIN
+#define WEIGHTS_THIS    WEIGHTS_DARWIN
+#elif defined(__sun) || defined(__illumos__)
+#define MODEL_THIS      MODEL_ILLUMOS
+#define WEIGHTS_THIS    WEIGHTS_ILLUMOS
+#elif defined(__HAIKU__)
+#define MODEL_THIS      MODEL_HAIKU
+#define WEIGHTS_THIS    WEIGHTS_GENERIC
+#else
+#define MODEL_THIS      MODEL_NATIVE
+#define WEIGHTS_THIS    WEIGHTS_GENERIC
+#endif
+
+const unsigned int libfree_reclaim_weights[RECLAIM_NCLASSES] = WEIGHTS_THIS;
+
+/*
+ * Fixtures (--fixture-record, --fixture)
+ * 
+ * A fixture is the raw counters of successive samples, one line each:
+ * 
+ *     free-fixture 2 freebsd
+ *     sample page_size=4096 page_count=2030316 free_count=1524609 ...
+ * 
+ * While recording, every sample a sampler takes appends its line.
+ * Replaying runs the lines through the recording backend's compute
+ * function on whatever platform the replay runs on, and tags each
+ * sample with that backend's model so mem_derive() follows its rules.
+ * Swap device rows, the --arc breakdown and the Darwin detail are not
+ * part of a sample's counters and are not recorded.
+ */
+#define FIXTURE_MAGIC   "free-fixture"
+#define FIXTURE_VERSION 2
+
+static FILE *fixture_file;          /* while recording */
+static unsigned int fixture_model;  /* while replaying */
+static raw_sample_t *fixture_samples;
+static int fixture_nsamples;
+static int fixture_next;            /* the sample fixture_sample() returns next */
+
+int fixture_record(const char *path) {
+    fixture_close();
+    if (MODEL_THIS == MODEL_NATIVE) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    fixture_file = fopen(path, "w");
+    if (fixture_file == NULL) {
+        return -1;
+    }
+    fprintf(fixture_file, "%s %d %s\n", FIXTURE_MAGIC, FIXTURE_VERSION, models[MODEL_THIS].name);
+    return 0;
+}
+
+/* Append one sample's counters while recording */
+static void fixture_log(const raw_sample_t *raw) {
+    const model_t *m = &models[MODEL_THIS];
+    
+    fputs("sample", fixture_file);
+    for (int i = 0; i < m->nraw; i++) {
+        if (RAW_HAS(raw, i)) {
+            fprintf(fixture_file, " %s=%llu", m->raw_names[i], (unsigned long long)raw->v[i]);
+        }
+    }
+    fputc('\n', fixture_file);
+    fflush(fixture_file);
+}
+
+/* One "sample name=value ..." line; -1 if it is not one or names an unknown counter */
+static int fixture_parse(char *line, const model_t *m, raw_sample_t *raw) {
+    char *tok, *last, *eq, *end;
+    
+    memset(raw, 0, sizeof(*raw));
+    tok = strtok_r(line, " \t\n", &last);
+    if (tok == NULL || strcmp(tok, "sample") != 0) {
+        return -1;
+    }
+    while ((tok = strtok_r(NULL, " \t\n", &last)) != NULL) {
+        int i;
+        
+        if ((eq = strchr(tok, '=')) == NULL || eq[1] == '\0') {
+            return -1;
+        }
+        *eq = '\0';
+        for (i = 0; i < m->nraw; i++) {
+            if (strcmp(tok, m->raw_names[i]) == 0) {
+                break;
+            }
+        }
+        if (i == m->nraw) {
+            return -1;
+        }
+        errno = 0;
+        unsigned long long value = strtoull(eq + 1, &end, 10);
+        if (*end != '\0' || errno != 0) {
+            return -1;
+        }
+        raw_set(raw, i, value);
+    }
+    return 0;
+}
+
+int fixture_replay(const char *path) {
+    char line[4096], magic[16], name[32];
+    int version, model = 0;
+    FILE *f;
+    
+    fixture_close();
+    if ((f = fopen(path, "r")) == NULL) {
+        return -1;
+    }
+    if (fgets(line, sizeof(line), f) != NULL &&
+        sscanf(line, "%15s %d %31s", magic, &version, name) == 3 &&
+        strcmp(magic, FIXTURE_MAGIC) == 0 && version == FIXTURE_VERSION) {
+        for (model = MODEL_COUNT - 1; model > MODEL_NATIVE; model--) {
+            if (strcmp(models[model].name, name) == 0) {
+                break;
+            }
+        }
+    }
+    while (model != MODEL_NATIVE && fgets(line, sizeof(line), f) != NULL) {
+        raw_sample_t *samples;
+        
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        samples = realloc(fixture_samples, (size_t)(fixture_nsamples + 1) * sizeof(*samples));
+        if (samples == NULL) {
+            fclose(f);
+            fixture_close();
+            errno = ENOMEM;
+            return -1;
+        }
+        fixture_samples = samples;
+        if (fixture_parse(line, &models[model], &fixture_samples[fixture_nsamples]) == -1) {
+            model = MODEL_NATIVE;
+            break;
+        }
+        fixture_nsamples++;
+    }
+    fclose(f);
+    if (model == MODEL_NATIVE || fixture_nsamples == 0) {
+        fixture_close();
+        errno = EINVAL;
+        return -1;
+    }
+    fixture_model = (unsigned int)model;
+    return fixture_nsamples;
+}
+
+/* The next recorded sample, then the last one again once they run out */
+int fixture_sample(mem_stats_t *stats) {
+    if (fixture_nsamples == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    models[fixture_model].compute(&fixture_samples[fixture_next], stats);
+    stats->model = fixture_model;
+    if (fixture_next < fixture_nsamples - 1) {
+        fixture_next++;
+    }
+    return 0;
+}
+
+void fixture_close(void) {
+    if (fixture_file != NULL) {
+        fclose(fixture_file);
+        fixture_file = NULL;
+    }
+    free(fixture_samples);
+    fixture_samples = NULL;
+    fixture_nsamples = 0;
+    fixture_next = 0;
+    fixture_model = MODEL_NATIVE;
+}
+
+/*
+ * The last step of every sampler_sample(): compute this backend's
+ * counters, and log them while a fixture is being recorded
+ */
+static void sample_compute(const raw_sample_t *raw, mem_stats_t *stats) {
+    models[MODEL_THIS].compute(raw, stats);
+    stats->model = MODEL_THIS;
+    if (fixture_file != NULL) {
+        fixture_log(raw);
+    }
+}
+
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__APPLE__)
+/*
+ * A sysctl name resolved once with sysctlnametomib(). Reading through
+ * the cached integer MIB skips the in-kernel name lookup that every
+ * sysctlbyname() call pays.
+ */
+typedef struct {
+    int mib[CTL_MAXNAME];
+    size_t len;             /* 0 if the name did not resolve */
+} sysctl_mib_t;
+
+#endif
+
+typedef struct pool pool_t;
+
+/*
+ * Sampler state kept alive between samples in continuous mode (-s/-c).
+ * sampler_init() resolves everything that does not change while the
+ * system is running (page size, physical memory, sysctl MIBs) so that
+ * sampler_sample() only performs the reads whose values actually move.
+ */
+#if defined(__sun) || defined(__illumos__)
+/* Where the I/O kstat of one swap device is, see swap_io_resolve() */
+typedef struct {
+    char path[MAXPATHLEN];          /* swap path this was resolved for */
+    char module[KSTAT_STRLEN];      /* driver, "" if there is no kstat */
+    int instance;
+    char name[KSTAT_STRLEN];        /* e.g. sd0,b */
+} swap_io_kstat_t;
+#endif
+
+struct sampler {
+    unsigned int flags;     /* SAMPLER_* flags passed to sampler_init() */
+    unsigned int caps;      /* CAP_* found by sampler_init() */
+    uint64_t page_size;
+#ifdef __FreeBSD__
+    sysctl_mib_t mib_page_count;
+    sysctl_mib_t mib_free_count;
+    sysctl_mib_t mib_active_count;
+    sysctl_mib_t mib_inactive_count;
+    sysctl_mib_t mib_wire_count;
+    sysctl_mib_t mib_laundry_count; /* optional: added in FreeBSD 11.1 */
+    sysctl_mib_t mib_arc[ARC_NFIELDS];  /* optional: ZFS loaded */
+    sysctl_mib_t mib_cache_count;   /* optional: removed in FreeBSD 12 */
+    sysctl_mib_t mib_bufspace;      /* optional */
+    sysctl_mib_t mib_swap_info;     /* optional: device index appended */
+    sysctl_mib_t mib_nswapdev;      /* number of vm.swap_info entries */
+    sysctl_mib_t mib_swap_reserved; /* SAMPLER_COMMIT only */
+    sysctl_mib_t mib_free_reserved;
+    int overcommit;                 /* vm.overcommit at init */
+    sysctl_mib_t mib_devstat;       /* optional: kern.devstat.all */
+#endif
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+    sysctl_mib_t mib_swappgsin;     /* optional: paging counters */
+    sysctl_mib_t mib_swappgsout;
+#endif
+#ifdef __DragonFly__
+    sysctl_mib_t mib_free_count;
+    sysctl_mib_t mib_active_count;
+    sysctl_mib_t mib_inactive_count;
+    sysctl_mib_t mib_wire_count;
+    sysctl_mib_t mib_cache_count;
+    sysctl_mib_t mib_swap_size;     /* optional: swap configured */
+    sysctl_mib_t mib_swap_free;
+#endif
+#if defined(__OpenBSD__) || defined(__DragonFly__) || defined(__APPLE__)
+    uint64_t physmem;
+#endif
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__APPLE__)
+    uint64_t free_target;   /* page daemon target in pages, 0 if not exported */
+#endif
+#ifdef __APPLE__
+    mach_port_t host;               /* mach_host_self(), one send right */
+    sysctl_mib_t mib_swapusage;
+    sysctl_mib_t mib_memorystatus;  /* optional: kern.memorystatus_level */
+    darwin_detail_t detail;         /* SAMPLER_DARWIN only */
+#endif
+#if defined(__sun) || defined(__illumos__)
+    kstat_ctl_t *kc;        /* kept open across samples */
+    kstat_ctl_t *kc_pages;  /* kc, or the SOURCE_VM worker's own handle */
+    kstat_ctl_t *kc_arc;    /* kc, or the SOURCE_CACHE worker's own */
+    kstat_ctl_t *kc_swap;   /* kc, or the SOURCE_SWAP worker's own */
+    kstat_t *ksp_pages;     /* unix:0:system_pages */
+    kstat_t *ksp_arc;       /* zfs:0:arcstats, NULL without ZFS */
+    /* Cached kstat_named_t indexes into ks_data, -1 until resolved */
+    int idx_physmem;
+    int idx_freemem;
+    int idx_pp_kernel;
+    int idx_lotsfree;
+    int idx_arc[ARC_NFIELDS];
+    struct swaptable *swt;  /* reused while the device count is stable */
+    char *swt_paths;        /* one MAXPATHLEN buffer per entry */
+    int swt_n;              /* entries allocated in swt */
+    swap_io_kstat_t *swap_io;   /* SAMPLER_SWAP_IO, one per swap_devs row */
+    int swap_io_alloc;
+#endif
+#if defined(__NetBSD__) || defined(__OpenBSD__)
+    struct swapent *swap_ents;  /* SWAP_STATS buffer, grown on demand */
+    int swap_ents_alloc;
+#endif
+#ifdef HAVE_SWAP_DEVICES
+    swap_dev_t *swap_devs;  /* rows from the latest sample */
+    int swap_ndevs;
+    int swap_devs_alloc;
+#endif
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+    char *io_buf;           /* SAMPLER_SWAP_IO device table, grown on demand */
+    size_t io_size;
+#endif
+#ifdef HAVE_ZFS_ARC
+    int has_arc;            /* arcstats exist (ZFS loaded) */
+    arc_stats_t arc;        /* from the latest sample */
+#endif
+#ifdef HAVE_PARALLEL
+    pool_t *pool;           /* --deadline workers, NULL when serial */
+    unsigned int stale;     /* SOURCE_* bits of the latest sample */
+#endif
+};
+
+static int sampler_init(sampler_t *s, unsigned int flags);
+static void sampler_destroy(sampler_t *s);
+#ifdef HAVE_PARALLEL
+static int pool_sample(sampler_t *s, raw_sample_t *raw);
+static void pool_destroy(sampler_t *s);
+#endif
+
+#ifdef HAVE_ZFS_ARC
+const char *const libfree_arc_names[ARC_NFIELDS] = {
+    "size", "c_min",
+    "mru_evictable_data", "mru_evictable_metadata",
+    "mfu_evictable_data", "mfu_evictable_metadata",
+    "c", "c_max", "mru_size", "mfu_size", "metadata_size",
+    "compressed_size", "uncompressed_size", "hits", "misses"
+};
+
+#endif
+
+
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__APPLE__)
+/*
+ * Resolve a sysctl name into its integer MIB.
+ * Returns -1 (and marks the MIB unusable) if the name does not exist,
+ * which lets callers treat optional sources as absent.
+ */
+static int mib_resolve(const char *name, sysctl_mib_t *m) {
+    m->len = sizeof(m->mib) / sizeof(m->mib[0]);
+    if (sysctlnametomib(name, m->mib, &m->len) == -1) {
+        m->len = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Same as mib_resolve() for sysctls the sampler cannot work without */
+static int mib_require(const char *name, sysctl_mib_t *m) {
+    if (mib_resolve(name, m) == -1) {
+        return fail(errno, "sysctl %s", name);
+    }
+    return 0;
+}
+
+/* Read a resolved MIB; returns -1 if unresolved or the read fails */
+static int mib_read(const sysctl_mib_t *m, void *buf, size_t size) {
+    size_t len = size;
+    
+    if (m->len == 0) {
+        return -1;
+    }
+    return sysctl(m->mib, (u_int)m->len, buf, &len, NULL, 0);
+}
+
+/* A u_int read once at init, such as a page count; 0 if not exported */
+static u_int sysctl_uint(const char *name) {
+    u_int value;
+    size_t len = sizeof(value);
+    
+    if (sysctlbyname(name, &value, &len, NULL, 0) == -1) {
+        return 0;
+    }
+    return value;
+}
+#endif
+
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+/*
+ * Read a vmmeter event counter. FreeBSD 12+ keeps these in 64-bit
+ * counter(9)s but still answers 4-byte requests; older kernels and
+ * DragonFly only have u_int. Accept whichever width comes back.
+ */
+static int mib_read_counter(const sysctl_mib_t *m, uint64_t *value) {
+    union {
+        uint32_t u32;
+        uint64_t u64;
+    } v;
+    size_t len = sizeof(v.u64);
+    
+    if (m->len == 0 || sysctl(m->mib, (u_int)m->len, &v, &len, NULL, 0) == -1) {
+        return -1;
+    }
+    if (len == sizeof(v.u32)) {
+        *value = v.u32;
+    } else if (len == sizeof(v.u64)) {
+        *value = v.u64;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Read a u_int counter into raw counter i; -1 if unresolved or the read fails */
+static int mib_read_raw(const sysctl_mib_t *m, raw_sample_t *raw, int i) {
+    u_int value;
+    
+    if (mib_read(m, &value, sizeof(value)) == -1) {
+        return -1;
+    }
+    raw_set(raw, i, value);
+    return 0;
+}
+
+/* v_swappgsin/v_swappgsout into raw counters in and out, both or neither */
+static void mib_sample_swap_paging(const sampler_t *s, raw_sample_t *raw, int in, int out) {
+    uint64_t pgsin, pgsout;
+    
+    if (mib_read_counter(&s->mib_swappgsin, &pgsin) == 0 &&
+        mib_read_counter(&s->mib_swappgsout, &pgsout) == 0) {
+        raw_set(raw, in, pgsin);
+        raw_set(raw, out, pgsout);
+    }
+}
+#endif
+
+#ifdef HAVE_SWAP_DEVICES
+/* Make room for n per-device swap rows, keeping rows already cached */
+static int swap_devs_reserve(sampler_t *s, int n) {
+    swap_dev_t *devs;
+    
+    if (n <= s->swap_devs_alloc) {
+        return 0;
+    }
+    devs = realloc(s->swap_devs, (size_t)n * sizeof(*devs));
+    if (devs == NULL) {
+        return fail(ENOMEM, "realloc");
+    }
+    memset(devs + s->swap_devs_alloc, 0,
+           (size_t)(n - s->swap_devs_alloc) * sizeof(*devs));
+    s->swap_devs = devs;
+    s->swap_devs_alloc = n;
+    return 0;
+}
+#endif
+
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+/*
+ * Row i for device id. The cached name is cleared when a different
+ * device now occupies the slot, so callers only resolve a name (which
+ * may cost a syscall) when name[0] is empty.
+ */
+static swap_dev_t *swap_devs_slot(sampler_t *s, int i, uint64_t id) {
+    swap_dev_t *d = &s->swap_devs[i];
+    
+    if (d->id != id) {
+        d->id = id;
+        d->name[0] = '\0';
+    }
+    return d;
+}
+
+/*
+ * Read a device table sysctl (kern.devstat.all, hw.iostats,
+ * hw.diskstats) into s->io_buf. The buffer is kept and only grows, so
+ * a sample is one call; when a disk attached since the last sizing,
+ * size it again. Returns the bytes read, 0 if the table is unavailable.
+ */
+static size_t swap_io_table(sampler_t *s, const int *mib, u_int miblen) {
+    size_t len;
+    
+    for (int tries = 0; tries < 4; tries++) {
+        len = s->io_size;
+        if (len > 0 && sysctl(mib, miblen, s->io_buf, &len, NULL, 0) == 0) {
+            return len;
+        }
+        if (len > 0 && errno != ENOMEM) {
+            return 0;
+        }
+        if (sysctl(mib, miblen, NULL, &len, NULL, 0) == -1 || len == 0) {
+            return 0;
+        }
+        len += len / 4 + 1024;
+        char *buf = realloc(s->io_buf, len);
+        if (buf == NULL) {
+            return 0;
+        }
+        s->io_buf = buf;
+        s->io_size = len;
+    }
+    return 0;
+}
+
+/*
+ * Whether disk is the device swap path is on: disk "ada0" for
+ * /dev/ada0p3, "wd0" for /dev/wd0b, or the whole name for a wedge or
+ * partition with statistics of its own. Returns the length matched,
+ * so the most specific entry wins, or 0.
+ */
+static size_t swap_io_match(const char *path, const char *disk) {
+    const char *base = strrchr(path, '/');
+    size_t len = strlen(disk);
+    
+    base = base != NULL ? base + 1 : path;
+    if (len == 0 || strncmp(base, disk, len) != 0 ||
+        (base[len] >= '0' && base[len] <= '9')) {
+        return 0;
+    }
+    return len;
+}
+#endif
+
+#ifdef __FreeBSD__
+/*
+ * FreeBSD Memory Statistics Retrieval
+ * 
+ * FreeBSD uses the vm.stats.vm.v_* sysctl hierarchy to expose virtual memory
+ * statistics. Each statistic is a separate sysctl; sampler_init() resolves
+ * every name once with sysctlnametomib() and samples read the cached MIBs.
+ * 
+ * Key differences from NetBSD/OpenBSD:
+ * - No unified uvmexp structure; each stat is a separate sysctl
+ * - Uses xswdev structure for swap device information
+ * - Supports v_cache_count (file cache) on some versions
+ * - Buffer memory available via vfs.bufspace
+ * - Total memory calculated from managed pages (v_page_count)
+ */
+static int sampler_init(sampler_t *s, unsigned int flags) {
+    unsigned int page_size;
+    size_t len;
+    
+    memset(s, 0, sizeof(*s));
+    s->flags = flags;
+    
+    /* Page size is fixed at boot, read it once */
+    len = sizeof(page_size);
+    if (sysctlbyname("vm.stats.vm.v_page_size", &page_size, &len, NULL, 0) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_page_size");
+    }
+    s->page_size = page_size;
+    
+    /* Core page counters must exist */
+    if (mib_require("vm.stats.vm.v_page_count", &s->mib_page_count) == -1 ||
+        mib_require("vm.stats.vm.v_free_count", &s->mib_free_count) == -1 ||
+        mib_require("vm.stats.vm.v_active_count", &s->mib_active_count) == -1 ||
+        mib_require("vm.stats.vm.v_inactive_count", &s->mib_inactive_count) == -1 ||
+        mib_require("vm.stats.vm.v_wire_count", &s->mib_wire_count) == -1) {
+        return -1;
+    }
+    
+    /*
+     * Optional sources: a name that does not resolve is left with an
+     * empty MIB and skipped by every later sample
+     */
+    /*
+     * FreeBSD has no aggregate arcstats node: every field is its own leaf,
+     * so the cost is one sysctl per field. Resolving them here at least
+     * turns each into a single MIB read, and only --arc reads them all.
+     */
+    for (int i = 0; i < ARC_NFIELDS; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "kstat.zfs.misc.arcstats.%s", libfree_arc_names[i]);
+        mib_resolve(name, &s->mib_arc[i]);
+    }
+    s->has_arc = s->mib_arc[ARC_SIZE].len != 0;
+    mib_resolve("vm.stats.vm.v_laundry_count", &s->mib_laundry_count);
+    s->free_target = sysctl_uint("vm.stats.vm.v_free_target");
+    mib_resolve("vm.stats.vm.v_cache_count", &s->mib_cache_count);
+    mib_resolve("vfs.bufspace", &s->mib_bufspace);
+    
+    /*
+     * vm.swap_info takes the device index as an extra MIB component,
+     * so make sure there is room for it after the resolved name
+     */
+    if (mib_resolve("vm.swap_info", &s->mib_swap_info) == 0 &&
+        s->mib_swap_info.len >= sizeof(s->mib_swap_info.mib) / sizeof(s->mib_swap_info.mib[0])) {
+        s->mib_swap_info.len = 0;
+    }
+    mib_resolve("vm.nswapdev", &s->mib_nswapdev);
+    mib_resolve("kern.devstat.all", &s->mib_devstat);
+    mib_resolve("vm.stats.vm.v_swappgsin", &s->mib_swappgsin);
+    mib_resolve("vm.stats.vm.v_swappgsout", &s->mib_swappgsout);
+    
+    mib_resolve("vm.swap_reserved", &s->mib_swap_reserved);
+    if ((flags & SAMPLER_COMMIT) && s->mib_swap_reserved.len != 0) {
+        mib_resolve("vm.stats.vm.v_free_reserved", &s->mib_free_reserved);
+        len = sizeof(s->overcommit);
+        if (sysctlbyname("vm.overcommit", &s->overcommit, &len, NULL, 0) == -1) {
+            s->overcommit = 0;
+        }
+    }
+    
+    if (s->mib_swap_info.len != 0) {
+        s->caps |= CAP_SWAP | CAP_SWAP_DEVICES;
+    }
+    if (s->mib_swappgsin.len != 0 && s->mib_swappgsout.len != 0) {
+        s->caps |= CAP_PAGING;
+    }
+    if (s->has_arc) {
+        s->caps |= CAP_ARC;
+    }
+    if (s->mib_cache_count.len != 0) {
+        s->caps |= CAP_CACHE_COUNT;
+    }
+    if (s->mib_bufspace.len != 0) {
+        s->caps |= CAP_BUFSPACE;
+    }
+    if (s->mib_swap_reserved.len != 0) {
+        s->caps |= CAP_COMMIT;
+    }
+    if (s->mib_swap_info.len != 0 && s->mib_devstat.len != 0) {
+        s->caps |= CAP_SWAP_IO;
+    }
+    s->caps |= CAP_PARALLEL;
+    return 0;
+}
+
+/*
+ * Commit accounting, see freebsd_compute(). v_free_reserved only
+ * matters when vm.overcommit enforces the limit and counts RAM in it.
+ */
+static void sampler_sample_commit(sampler_t *s, raw_sample_t *raw) {
+    uint64_t value;
+    
+    if (mib_read_counter(&s->mib_swap_reserved, &value) == -1) {
+        return;
+    }
+    raw_set(raw, FREEBSD_SWAP_RESERVED, value);
+    raw_set(raw, FREEBSD_OVERCOMMIT, (uint64_t)s->overcommit);
+    if ((s->overcommit & 0x05) == 0x05 && mib_read_counter(&s->mib_free_reserved, &value) == 0) {
+        raw_set(raw, FREEBSD_FREE_RESERVED, value);
+    }
+}
+
+static void sampler_destroy(sampler_t *s) {
+    pool_destroy(s);
+    free(s->swap_devs);
+    free(s->io_buf);
+    s->swap_devs = NULL;
+    s->io_buf = NULL;
+    s->swap_devs_alloc = 0;
+    s->swap_ndevs = 0;
+    s->io_size = 0;
+}
+
+static uint64_t bintime_ns(const struct bintime *bt) {
+    return (uint64_t)bt->sec * 1000000000 +
+           (((uint64_t)1000000000 * (uint32_t)(bt->frac >> 32)) >> 32);
+}
+
+/*
+ * Swap device I/O from kern.devstat.all: a generation number, then a
+ * struct devstat per disk. devstat counts whole disks, so a swap
+ * partition reports the traffic of the disk it is on. Latency is the
+ * summed duration of completed reads and writes.
+ */
+static void swap_io_devstat(sampler_t *s) {
+    size_t len = swap_io_table(s, s->mib_devstat.mib, (u_int)s->mib_devstat.len);
+    const struct devstat *ds = (const struct devstat *)(s->io_buf + sizeof(long));
+    size_t n = len > sizeof(long) ? (len - sizeof(long)) / sizeof(*ds) : 0;
+    
+    for (int i = 0; i < s->swap_ndevs; i++) {
+        swap_dev_t *d = &s->swap_devs[i];
+        const struct devstat *best = NULL;
+        size_t best_len = 0;
+        
+        for (size_t j = 0; j < n; j++) {
+            char disk[DEVSTAT_NAME_LEN + 16];
+            snprintf(disk, sizeof(disk), "%s%d", ds[j].device_name, ds[j].unit_number);
+            size_t m = swap_io_match(d->name, disk);
+            if (m > best_len) {
+                best = &ds[j];
+                best_len = m;
+            }
+        }
+        d->has_io = best != NULL;
+        if (best != NULL) {
+            d->read_bytes = best->bytes[DEVSTAT_READ];
+            d->write_bytes = best->bytes[DEVSTAT_WRITE];
+            d->reads = best->operations[DEVSTAT_READ];
+            d->writes = best->operations[DEVSTAT_WRITE];
+            d->io_time_ns = bintime_ns(&best->duration[DEVSTAT_READ]) +
+                            bintime_ns(&best->duration[DEVSTAT_WRITE]);
+        }
+    }
+}
+
+/*
+ * The three SOURCE_* reads of a sample. Each fills only its own raw
+ * counters, in the range source_raw[] gives it, so sampler_sample()
+ * can run them in turn or hand them to the --deadline workers; the
+ * cache source writes the ARC breakdown to arc rather than s->arc for
+ * the same reason.
+ */
+static const uint32_t source_raw[SOURCE_COUNT] = {
+    RAW_RANGE(FREEBSD_PAGE_COUNT, FREEBSD_FREE_TARGET),
+    RAW_RANGE(FREEBSD_ARC, FREEBSD_BUFSPACE),
+    RAW_RANGE(FREEBSD_SWAP_NBLKS, FREEBSD_SWAPPGSOUT),
+};
+
+static int sample_vm(sampler_t *s, raw_sample_t *raw, arc_stats_t *arc) {
+    (void)arc;
+    
+    /* Get memory statistics */
+    if (mib_read_raw(&s->mib_page_count, raw, FREEBSD_PAGE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_page_count");
+    }
+    if (mib_read_raw(&s->mib_free_count, raw, FREEBSD_FREE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_free_count");
+    }
+    if (mib_read_raw(&s->mib_active_count, raw, FREEBSD_ACTIVE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_active_count");
+    }
+    if (mib_read_raw(&s->mib_inactive_count, raw, FREEBSD_INACTIVE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_inactive_count");
+    }
+    if (mib_read_raw(&s->mib_wire_count, raw, FREEBSD_WIRE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_wire_count");
+    }
+    /* Dirty pages waiting for a pageout */
+    mib_read_raw(&s->mib_laundry_count, raw, FREEBSD_LAUNDRY_COUNT);
+    raw_set(raw, FREEBSD_FREE_TARGET, s->free_target);
+    return 0;
+}
+
+static int sample_cache(sampler_t *s, raw_sample_t *raw, arc_stats_t *arc) {
+    /*
+     * Try to get ZFS ARC cache size first
+     * On FreeBSD systems with ZFS, the ARC is the primary cache
+     * and can use significant memory (often gigabytes)
+     * If ZFS is not available, fall back to v_cache_count
+     * 
+     * Every sample reads the ARC_NBASE fields mem_arc_pinned() needs, six
+     * sysctls, so available is the same whatever is displayed; c_min
+     * is among them since vfs.zfs.arc.min can be tuned at runtime.
+     * The rest of the breakdown comes only with --arc.
+     */
+    int narc = (s->flags & SAMPLER_ARC) ? ARC_NFIELDS : ARC_NBASE;
+    arc->present = 0;
+    for (int i = 0; s->has_arc && i < narc; i++) {
+        if (mib_read(&s->mib_arc[i], &arc->v[i], sizeof(arc->v[i])) == 0) {
+            arc->present |= 1u << i;
+            if (i < ARC_NBASE) {
+                raw_set(raw, FREEBSD_ARC + i, arc->v[i]);
+            }
+        }
+    }
+    if (!(arc->present & (1u << ARC_SIZE)) || arc->v[ARC_SIZE] == 0) {
+        /* No ZFS: traditional cache count and buffer memory */
+        mib_read_raw(&s->mib_cache_count, raw, FREEBSD_CACHE_COUNT);
+        mib_read_raw(&s->mib_bufspace, raw, FREEBSD_BUFSPACE);
+    }
+    return 0;
+}
+
+static int sample_swap(sampler_t *s, raw_sample_t *raw, arc_stats_t *arc) {
+    uint64_t page_size = s->page_size;
+    uint64_t nblks = 0, used = 0;
+    size_t len;
+    
+    (void)arc;
+    
+    /*
+     * Get swap information
+     * FreeBSD can have multiple swap devices, so we iterate through
+     * vm.swap_info using xswdev structure to sum up all swap space.
+     * The sysctl returns one device per call and has no batch form;
+     * vm.nswapdev tells up front how many entries there are, so the
+     * walk no longer ends with a read that fails.
+     */
+    struct xswdev xsw;
+    sysctl_mib_t *swap_mib = &s->mib_swap_info;
+    int nswapdev = -1;
+    int ndevs = 0;
+    
+    if (swap_mib->len > 0) {
+        if (mib_read(&s->mib_nswapdev, &nswapdev, sizeof(nswapdev)) == -1) {
+            nswapdev = -1;  /* unknown: probe until a read fails */
+        }
+        if ((s->flags & SAMPLER_SWAP_DEVICES) && nswapdev > 0 &&
+            swap_devs_reserve(s, nswapdev) == -1) {
+            return -1;
+        }
+        
+        for (int i = 0; nswapdev < 0 || i < nswapdev; i++) {
+            swap_mib->mib[swap_mib->len] = i;
+            len = sizeof(xsw);
+            if (sysctl(swap_mib->mib, (u_int)swap_mib->len + 1, &xsw, &len, NULL, 0) == -1) {
+                /* End of list, or a device went away mid-sample */
+                break;
+            }
+            nblks += (uint64_t)xsw.xsw_nblks;
+            used += (uint64_t)xsw.xsw_used;
+            
+            if (s->flags & SAMPLER_SWAP_DEVICES) {
+                if (swap_devs_reserve(s, i + 1) == -1) {
+                    return -1;
+                }
+                swap_dev_t *d = swap_devs_slot(s, i, (uint64_t)xsw.xsw_dev);
+                if (d->name[0] == '\0') {
+                    /* devname() is a sysctl too; only for new devices */
+                    const char *name = devname(xsw.xsw_dev, S_IFCHR);
+                    snprintf(d->name, sizeof(d->name), "/dev/%s",
+                             name != NULL ? name : "??");
+                }
+                d->total = (uint64_t)xsw.xsw_nblks * page_size;
+                d->used = (uint64_t)xsw.xsw_used * page_size;
+            }
+            ndevs++;
+        }
+    }
+    raw_set(raw, FREEBSD_SWAP_NBLKS, nblks);
+    raw_set(raw, FREEBSD_SWAP_USED, used);
+    s->swap_ndevs = (s->flags & SAMPLER_SWAP_DEVICES) ? ndevs : 0;
+    if ((s->flags & SAMPLER_SWAP_IO) && s->swap_ndevs > 0 && s->mib_devstat.len != 0) {
+        swap_io_devstat(s);
+    }
+    
+    mib_sample_swap_paging(s, raw, FREEBSD_SWAPPGSIN, FREEBSD_SWAPPGSOUT);
+    return 0;
+}
+
+int sampler_sample(sampler_t *s, mem_stats_t *stats) {
+    raw_sample_t raw;
+    
+    memset(&raw, 0, sizeof(raw));
+    if (s->pool != NULL) {
+        if (pool_sample(s, &raw) == -1) {
+            return -1;
+        }
+    } else if (sample_vm(s, &raw, NULL) == -1 || sample_cache(s, &raw, &s->arc) == -1 ||
+               sample_swap(s, &raw, NULL) == -1) {
+        return -1;
+    }
+    raw_set(&raw, FREEBSD_PAGE_SIZE, s->page_size);
+    
+    /* Derived from the swap and VM figures, so after both are in */
+    if (s->flags & SAMPLER_COMMIT) {
+        sampler_sample_commit(s, &raw);
+    }
+    sample_compute(&raw, stats);
+    stats->stale = s->stale;
+    return 0;
+}
+#endif
+
+#if defined(__NetBSD__) || defined(__OpenBSD__)
+/*
+ * Swap device I/O for SAMPLER_SWAP_IO. SWAP_STATS has no traffic
+ * counters, so they come from the disk statistics table, hw.iostats
+ * on NetBSD and hw.diskstats on OpenBSD, matched by name: a wedge
+ * (dk1) has its own entry, a disklabel partition (wd0b) reports the
+ * disk it is on. Both tables count busy time rather than time per
+ * operation.
+ */
+static void swap_io_disks(sampler_t *s) {
+#ifdef __NetBSD__
+    int mib[3] = { CTL_HW, HW_IOSTATS, sizeof(struct io_sysctl) };
+    size_t len = swap_io_table(s, mib, 3);
+    const struct io_sysctl *ds = (const struct io_sysctl *)s->io_buf;
+#else
+    int mib[2] = { CTL_HW, HW_DISKSTATS };
+    size_t len = swap_io_table(s, mib, 2);
+    const struct diskstats *ds = (const struct diskstats *)s->io_buf;
+#endif
+    size_t n = len / sizeof(*ds);
+    
+    for (int i = 0; i < s->swap_ndevs; i++) {
+        swap_dev_t *d = &s->swap_devs[i];
+        size_t best = 0, best_len = 0;
+        
+        for (size_t j = 0; j < n; j++) {
+#ifdef __NetBSD__
+            size_t m = swap_io_match(d->name, ds[j].name);
+#else
+            size_t m = swap_io_match(d->name, ds[j].ds_name);
+#endif
+            if (m > best_len) {
+                best = j;
+                best_len = m;
+            }
+        }
+        d->has_io = best_len > 0;
+        if (best_len == 0) {
+            continue;
+        }
+#ifdef __NetBSD__
+        d->read_bytes = ds[best].rbytes;
+        d->write_bytes = ds[best].wbytes;
+        d->reads = ds[best].rxfer;
+        d->writes = ds[best].wxfer;
+        d->io_time_ns = (uint64_t)ds[best].time_sec * 1000000000 +
+                        (uint64_t)ds[best].time_usec * 1000;
+#else
+        d->read_bytes = ds[best].ds_rbytes;
+        d->write_bytes = ds[best].ds_wbytes;
+        d->reads = ds[best].ds_rxfer;
+        d->writes = ds[best].ds_wxfer;
+        d->io_time_ns = (uint64_t)ds[best].ds_time.tv_sec * 1000000000 +
+                        (uint64_t)ds[best].ds_time.tv_usec * 1000;
+#endif
+    }
+}
+
+/*
+ * Per-device swap rows via swapctl(SWAP_STATS)
+ * Only used with SAMPLER_SWAP_DEVICES: the uvmexp snapshot already
+ * carries the swap totals, so plain samples skip these two calls.
+ * se_nblks and se_inuse are counted in DEV_BSIZE blocks.
+ */
+static int swap_stats_devices(sampler_t *s) {
+    int i, n;
+    
+    s->swap_ndevs = 0;
+    n = swapctl(SWAP_NSWAP, NULL, 0);
+    if (n <= 0) {
+        return 0;
+    }
+    
+    /* The swapent buffer is kept and only grows */
+    if (n > s->swap_ents_alloc) {
+        struct swapent *ents = realloc(s->swap_ents, (size_t)n * sizeof(*ents));
+        if (ents == NULL) {
+            return fail(ENOMEM, "realloc");
+        }
+        s->swap_ents = ents;
+        s->swap_ents_alloc = n;
+    }
+    
+    n = swapctl(SWAP_STATS, s->swap_ents, n);
+    if (n <= 0) {
+        return 0;
+    }
+    
+    if (swap_devs_reserve(s, n) == -1) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        struct swapent *se = &s->swap_ents[i];
+        swap_dev_t *d = swap_devs_slot(s, i, (uint64_t)se->se_dev);
+        
+        if (d->name[0] == '\0') {
+            strlcpy(d->name, se->se_path, sizeof(d->name));
+        }
+        d->total = (uint64_t)se->se_nblks * DEV_BSIZE;
+        d->used = (uint64_t)se->se_inuse * DEV_BSIZE;
+    }
+    s->swap_ndevs = n;
+    
+    if (s->flags & SAMPLER_SWAP_IO) {
+        swap_io_disks(s);
+    }
+    return 0;
+}
+
+static void swap_stats_release(sampler_t *s) {
+    free(s->swap_ents);
+    free(s->swap_devs);
+    free(s->io_buf);
+    s->swap_ents = NULL;
+    s->swap_devs = NULL;
+    s->io_buf = NULL;
+    s->io_size = 0;
+    s->swap_ents_alloc = 0;
+    s->swap_devs_alloc = 0;
+    s->swap_ndevs = 0;
+}
+#endif
+
+#ifdef __NetBSD__
+/*
+ * NetBSD Memory Statistics Retrieval
+ * 
+ * NetBSD uses UVM (Unified Virtual Memory) and provides memory statistics
+ * through the uvmexp_sysctl structure accessed via VM_UVMEXP2 sysctl.
+ * 
+ * Key differences from FreeBSD/OpenBSD:
+ * - Uses uvmexp_sysctl (VM_UVMEXP2) not uvmexp (VM_UVMEXP)
+ * - uvmexp_sysctl has int64_t fields vs. int in regular uvmexp
+ * - Includes separate execpages and filepages for cache calculation
+ * - Has vm.bufmem sysctl for buffer memory
+ * - Total memory from npages (managed pages), not hw.physmem
+ * - This matches NetBSD's own /usr/pkg/bin/free behavior
+ * 
+ * Note: VM_UVMEXP provides struct uvmexp which lacks active/inactive fields,
+ * while VM_UVMEXP2 provides struct uvmexp_sysctl with all needed counters.
+ * 
+ * Every field already comes from the one uvmexp_sysctl copy, so
+ * SAMPLER_SNAPSHOT changes nothing here; uvm_clamp() runs either way.
+ */
+static int sampler_init(sampler_t *s, unsigned int flags) {
+    memset(s, 0, sizeof(*s));
+    s->flags = flags;
+    
+    /* Page size is part of every uvmexp_sysctl snapshot */
+    s->page_size = 0;
+    
+    /* All of it comes in the one uvmexp2 snapshot */
+    s->caps = CAP_SWAP | CAP_SWAP_DEVICES | CAP_PAGING | CAP_CACHE_COUNT | CAP_COMMIT |
+              CAP_SNAPSHOT | CAP_SWAP_IO;
+    return 0;
+}
+
+static void sampler_destroy(sampler_t *s) {
+    swap_stats_release(s);
+}
+
+int sampler_sample(sampler_t *s, mem_stats_t *stats) {
+    struct uvmexp_sysctl uvmexp;
+    raw_sample_t raw;
+    size_t len;
+    int mib[2];
+    
+    /* Get UVM statistics using uvmexp_sysctl structure */
+    mib[0] = CTL_VM;
+    mib[1] = VM_UVMEXP2;
+    len = sizeof(uvmexp);
+    if (sysctl(mib, 2, &uvmexp, &len, NULL, 0) == -1) {
+        return fail(errno, "sysctl vm.uvmexp2");
+    }
+    
+    /* uvmexp_sysctl has pagesize as int64_t */
+    s->page_size = (uint64_t)uvmexp.pagesize;
+    
+    /* One snapshot, so every counter comes from the same copy */
+    memset(&raw, 0, sizeof(raw));
+    raw_set(&raw, NETBSD_PAGESIZE, (uint64_t)uvmexp.pagesize);
+    raw_set(&raw, NETBSD_NPAGES, (uint64_t)uvmexp.npages);
+    raw_set(&raw, NETBSD_FREE, (uint64_t)uvmexp.free);
+    raw_set(&raw, NETBSD_ACTIVE, (uint64_t)uvmexp.active);
+    raw_set(&raw, NETBSD_INACTIVE, (uint64_t)uvmexp.inactive);
+    raw_set(&raw, NETBSD_WIRED, (uint64_t)uvmexp.wired);
+    raw_set(&raw, NETBSD_FREETARG, (uint64_t)uvmexp.freetarg);
+    raw_set(&raw, NETBSD_EXECPAGES, (uint64_t)uvmexp.execpages);
+    raw_set(&raw, NETBSD_FILEPAGES, (uint64_t)uvmexp.filepages);
+    raw_set(&raw, NETBSD_SWPAGES, (uint64_t)uvmexp.swpages);
+    raw_set(&raw, NETBSD_SWPGINUSE, (uint64_t)uvmexp.swpginuse);
+    raw_set(&raw, NETBSD_PGSWAPIN, (uint64_t)uvmexp.pgswapin);
+    raw_set(&raw, NETBSD_PGSWAPOUT, (uint64_t)uvmexp.pgswapout);
+    if (s->flags & SAMPLER_COMMIT) {
+        raw_set(&raw, NETBSD_ANONPAGES, (uint64_t)uvmexp.anonpages);
+        raw_set(&raw, NETBSD_SWPGONLY, (uint64_t)uvmexp.swpgonly);
+    }
+    sample_compute(&raw, stats);
+    
+    /* Per-device rows only when --swap-devices asked for them */
+    if ((s->flags & SAMPLER_SWAP_DEVICES) && swap_stats_devices(s) == -1) {
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+#ifdef __OpenBSD__
+/*
+ * OpenBSD Memory Statistics Retrieval
+ * 
+ * OpenBSD uses UVM like NetBSD but with some key differences in how
+ * memory statistics are exposed and calculated.
+ * 
+ * Key differences from FreeBSD/NetBSD:
+ * - Uses hw.physmem64 for total memory (actual physical RAM)
+ * - Uses struct uvmexp (VM_UVMEXP), not uvmexp_sysctl
+ * - uvmexp has int fields (not int64_t like NetBSD's uvmexp_sysctl)
+ * - Has vnodepages/vtextpages for vnode and vtext cache
+ * - No easily accessible buffer memory sysctl (unlike NetBSD's vm.bufmem)
+ * - Swap information directly in uvmexp structure
+ * 
+ * Memory calculation approach:
+ * - Total = hw.physmem64 (matches /usr/local/bin/free behavior)
+ *   This differs from using npages which would give "managed" pages
+ * - Used = total - free (simple calculation)
+ * - Available = free + inactive + cache (reclaimable memory)
+ * 
+ * Note: vmstat shows "pages managed" which is less than hw.physmem
+ * because some memory is reserved for kernel use at boot.
+ * 
+ * SAMPLER_SNAPSHOT (--snapshot) uses npages for the total instead, so
+ * total and the residual cache come from the same uvmexp copy and used
+ * no longer counts the memory reserved at boot. Either way the sample
+ * goes through uvm_clamp() before the cache residual is taken.
+ */
+static int sampler_init(sampler_t *s, unsigned int flags) {
+    size_t len;
+    int mib[2];
+    
+    memset(s, 0, sizeof(*s));
+    s->flags = flags;
+    
+    /*
+     * Get physical memory from hw.physmem64
+     * This is the actual installed RAM and matches /usr/local/bin/free
+     * Alternative would be to use uvmexp.npages * pagesize for "managed" pages
+     * Installed RAM does not change at runtime, so it is read only once.
+     * SAMPLER_SNAPSHOT takes the total from uvmexp and never needs it.
+     */
+    if (!(flags & SAMPLER_SNAPSHOT)) {
+        mib[0] = CTL_HW;
+        mib[1] = HW_PHYSMEM64;
+        len = sizeof(s->physmem);
+        if (sysctl(mib, 2, &s->physmem, &len, NULL, 0) == -1) {
+            return fail(errno, "sysctl hw.physmem64");
+        }
+    }
+    
+    /* Page size is part of every uvmexp snapshot */
+    s->page_size = 0;
+    
+    s->caps = CAP_SWAP | CAP_SWAP_DEVICES | CAP_PAGING | CAP_COMMIT | CAP_SNAPSHOT | CAP_SWAP_IO;
+    return 0;
+}
+
+static void sampler_destroy(sampler_t *s) {
+    swap_stats_release(s);
+}
+
+int sampler_sample(sampler_t *s, mem_stats_t *stats) {
+    struct uvmexp uvmexp;
+    raw_sample_t raw;
+    size_t len;
+    int mib[2];
+    
+    /* Get UVM statistics via VM_UVMEXP (struct uvmexp) */
+    mib[0] = CTL_VM;
+    mib[1] = VM_UVMEXP;
+    len = sizeof(uvmexp);
+    if (sysctl(mib, 2, &uvmexp, &len, NULL, 0) == -1) {
+        return fail(errno, "sysctl vm.uvmexp");
+    }
+    
+    /* OpenBSD's uvmexp has pagesize as int (not int64_t) */
+    s->page_size = (uint64_t)uvmexp.pagesize;
+    
+    memset(&raw, 0, sizeof(raw));
+    raw_set(&raw, OPENBSD_PAGESIZE, (uint64_t)uvmexp.pagesize);
+    /* Without SAMPLER_SNAPSHOT the total is the installed RAM */
+    if (!(s->flags & SAMPLER_SNAPSHOT)) {
+        raw_set(&raw, OPENBSD_PHYSMEM, s->physmem);
+    }
+    raw_set(&raw, OPENBSD_NPAGES, (uint64_t)uvmexp.npages);
+    raw_set(&raw, OPENBSD_FREE, (uint64_t)uvmexp.free);
+    raw_set(&raw, OPENBSD_ACTIVE, (uint64_t)uvmexp.active);
+    raw_set(&raw, OPENBSD_INACTIVE, (uint64_t)uvmexp.inactive);
+    raw_set(&raw, OPENBSD_WIRED, (uint64_t)uvmexp.wired);
+    raw_set(&raw, OPENBSD_FREETARG, (uint64_t)uvmexp.freetarg);
+    raw_set(&raw, OPENBSD_SWPAGES, (uint64_t)uvmexp.swpages);
+    raw_set(&raw, OPENBSD_SWPGINUSE, (uint64_t)uvmexp.swpginuse);
+    raw_set(&raw, OPENBSD_PGSWAPIN, (uint64_t)uvmexp.pgswapin);
+    raw_set(&raw, OPENBSD_PGSWAPOUT, (uint64_t)uvmexp.pgswapout);
+    if (s->flags & SAMPLER_COMMIT) {
+        raw_set(&raw, OPENBSD_SWPGONLY, (uint64_t)uvmexp.swpgonly);
+    }
+    sample_compute(&raw, stats);
+    
+    /* Per-device rows only when --swap-devices asked for them */
+    if ((s->flags & SAMPLER_SWAP_DEVICES) && swap_stats_devices(s) == -1) {
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+#ifdef __DragonFly__
+/*
+ * DragonFly BSD Memory Statistics Retrieval
+ * 
+ * DragonFly BSD forked from FreeBSD 4.x but has evolved its own
+ * virtual memory system with significant differences from FreeBSD.
+ * 
+ * Key differences from other BSDs:
+ * - Uses individual vm.stats.vm.v_* sysctls (like FreeBSD) NOT struct vmmeter
+ * - Has v_cache_count for cached pages (similar to FreeBSD's v_cache_count)
+ * - Swap information via vm.swap_size and vm.swap_free (simpler than FreeBSD)
+ * - Physical memory from hw.physmem (returns unsigned long)
+ * - Page counts are in pages, need to multiply by pagesize
+ * 
+ * Memory calculation approach:
+ * - Total = hw.physmem (actual physical RAM)
+ * - Used = total - free (simple calculation like NetBSD/OpenBSD)
+ * - Available = free + inactive + cache (reclaimable memory)
+ * 
+ * Note: DragonFly's VM system includes some FreeBSD heritage but with
+ * its own DFLY VM improvements for multi-threading and NUMA support.
+ * The sysctl names are similar to FreeBSD but swap handling is simplified.
+ */
+static int sampler_init(sampler_t *s, unsigned int flags) {
+    size_t len;
+    unsigned long physmem;
+    u_int page_size;
+    
+    memset(s, 0, sizeof(*s));
+    s->flags = flags;
+    
+    /*
+     * Get physical memory from hw.physmem
+     * Returns unsigned long on DragonFly (actual installed RAM)
+     */
+    len = sizeof(physmem);
+    if (sysctlbyname("hw.physmem", &physmem, &len, NULL, 0) == -1) {
+        return fail(errno, "sysctl hw.physmem");
+    }
+    s->physmem = (uint64_t)physmem;
+    
+    /* Get page size (returns u_int on DragonFly) */
+    len = sizeof(page_size);
+    if (sysctlbyname("hw.pagesize", &page_size, &len, NULL, 0) == -1) {
+        return fail(errno, "sysctl hw.pagesize");
+    }
+    s->page_size = page_size;
+    
+    /* Resolve the per-sample counters once, see mib_resolve() */
+    if (mib_require("vm.stats.vm.v_free_count", &s->mib_free_count) == -1 ||
+        mib_require("vm.stats.vm.v_active_count", &s->mib_active_count) == -1 ||
+        mib_require("vm.stats.vm.v_inactive_count", &s->mib_inactive_count) == -1 ||
+        mib_require("vm.stats.vm.v_wire_count", &s->mib_wire_count) == -1 ||
+        mib_require("vm.stats.vm.v_cache_count", &s->mib_cache_count) == -1) {
+        return -1;
+    }
+    s->free_target = sysctl_uint("vm.stats.vm.v_free_target");
+    
+    /* Swap sysctls only exist once swap has been configured */
+    if (mib_resolve("vm.swap_size", &s->mib_swap_size) == 0 &&
+        mib_require("vm.swap_free", &s->mib_swap_free) == -1) {
+        return -1;
+    }
+    mib_resolve("vm.stats.vm.v_swappgsin", &s->mib_swappgsin);
+    mib_resolve("vm.stats.vm.v_swappgsout", &s->mib_swappgsout);
+    
+    s->caps = CAP_CACHE_COUNT;
+    if (s->mib_swap_size.len != 0) {
+        s->caps |= CAP_SWAP;
+    }
+    if (s->mib_swappgsin.len != 0 && s->mib_swappgsout.len != 0) {
+        s->caps |= CAP_PAGING;
+    }
+    return 0;
+}
+
+static void sampler_destroy(sampler_t *s) {
+    (void)s;
+}
+
+int sampler_sample(sampler_t *s, mem_stats_t *stats) {
+    raw_sample_t raw;
+    
+    memset(&raw, 0, sizeof(raw));
+    raw_set(&raw, DRAGONFLY_PAGESIZE, s->page_size);
+    raw_set(&raw, DRAGONFLY_PHYSMEM, s->physmem);
+    
+    /*
+     * Get VM page counts from individual sysctls
+     * DragonFly uses vm.stats.vm.v_* like FreeBSD (not struct vmmeter)
+     * 
+     * Page categories in DragonFly:
+     * - v_free_count: immediately available pages
+     * - v_active_count: recently accessed, hot pages
+     * - v_inactive_count: not recently used, can be reclaimed
+     * - v_wire_count: wired (locked) in memory, cannot be paged
+     * - v_cache_count: cached pages (quickly reclaimable)
+     */
+    if (mib_read_raw(&s->mib_free_count, &raw, DRAGONFLY_FREE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_free_count");
+    }
+    
+    if (mib_read_raw(&s->mib_active_count, &raw, DRAGONFLY_ACTIVE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_active_count");
+    }
+    
+    if (mib_read_raw(&s->mib_inactive_count, &raw, DRAGONFLY_INACTIVE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_inactive_count");
+    }
+    
+    if (mib_read_raw(&s->mib_wire_count, &raw, DRAGONFLY_WIRE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_wire_count");
+    }
+    
+    if (mib_read_raw(&s->mib_cache_count, &raw, DRAGONFLY_CACHE_COUNT) == -1) {
+        return fail(errno, "sysctl vm.stats.vm.v_cache_count");
+    }
+    raw_set(&raw, DRAGONFLY_FREE_TARGET, s->free_target);
+    
+    mib_sample_swap_paging(s, &raw, DRAGONFLY_SWAPPGSIN, DRAGONFLY_SWAPPGSOUT);
+    
+    /*
+     * Get swap information from vm.swap_size and vm.swap_free
+     * DragonFly provides simpler swap sysctls than FreeBSD's vm.swap_info
+     * Both values are in pages; a missing vm.swap_size means no swap
+     */
+    if (mib_read_raw(&s->mib_swap_size, &raw, DRAGONFLY_SWAP_SIZE) == 0 &&
+        mib_read_raw(&s->mib_swap_free, &raw, DRAGONFLY_SWAP_FREE) == -1) {
+        return fail(errno, "sysctl vm.swap_free");
+    }
+    
+    sample_compute(&raw, stats);
+    return 0;
+}
+#endif
+
+#ifdef __APPLE__
+/*
+ * macOS (Darwin) Memory Statistics Retrieval
+ * 
+ * macOS is based on Darwin which combines the Mach microkernel with
+ * FreeBSD userland components. Memory statistics come from different
+ * sources than traditional BSD systems.
+ * 
+ * Key differences from other BSDs:
+ * - Uses Mach host_statistics64() API for VM statistics
+ * - Uses sysctl for total memory (hw.memsize) and swap (vm.swapusage)
+ * - Page size typically 16KB on Apple Silicon, 4KB on Intel
+ * - Has memory compression (compressed pages don't count as used swap)
+ * - Has file-backed pages (app memory) and anonymous pages (data)
+ * - Speculative pages are like cache (pre-fetched for performance)
+ * 
+ * Memory calculation approach:
+ * - Total = hw.memsize (actual physical RAM)
+ * - Free = free_count (immediately available)
+ * - Active = active_count (recently accessed)
+ * - Inactive = inactive_count (not recently used)
+ * - Wired = wire_count (locked in memory, kernel use)
+ * - Cache = speculative_count + purgeable_count (reclaimable)
+ * - Compressed pages are counted as "used" but don't consume swap
+ * 
+ * Note: macOS aggressively uses memory for caching and compression,
+ * so "used" memory doesn't mean unavailable memory.
+ */
+static int sampler_init(sampler_t *s, unsigned int flags) {
+    size_t len;
+    
+    memset(s, 0, sizeof(*s));
+    s->flags = flags;
+    
+    /*
+     * Get physical memory from hw.memsize
+     * Returns uint64_t on macOS (actual installed RAM)
+     */
+    len = sizeof(s->physmem);
+    if (sysctlbyname("hw.memsize", &s->physmem, &len, NULL, 0) == -1) {
+        return fail(errno, "sysctl hw.memsize");
+    }
+    
+    /*
+     * Get page size
+     * Typically 16KB on Apple Silicon (M1/M2/M3), 4KB on Intel
+     */
+    len = sizeof(s->page_size);
+    if (sysctlbyname("hw.pagesize", &s->page_size, &len, NULL, 0) == -1) {
+        return fail(errno, "sysctl hw.pagesize");
+    }
+    
+    /*
+     * Every mach_host_self() call is a trap that adds a reference to
+     * the host port, so take it once; a sample is then one Mach call
+     * plus one sysctl through a cached MIB
+     */
+    s->host = mach_host_self();
+    if (mib_require("vm.swapusage", &s->mib_swapusage) == -1) {
+        return -1;
+    }
+    mib_resolve("kern.memorystatus_level", &s->mib_memorystatus);
+    s->free_target = sysctl_uint("vm.page_free_target");
+    
+    s->caps = CAP_SWAP | CAP_PAGING | CAP_CACHE_COUNT | CAP_DARWIN;
+    if (s->mib_memorystatus.len != 0) {
+        s->caps |= CAP_PRESSURE;
+    }
+    return 0;
+}
+
+static void sampler_destroy(sampler_t *s) {
+    if (s->host != MACH_PORT_NULL) {
+        mach_port_deallocate(mach_task_self(), s->host);
+        s->host = MACH_PORT_NULL;
+    }
+}
+
+int sampler_sample(sampler_t *s, mem_stats_t *stats) {
+    uint64_t pagesize = s->page_size;
+    mach_msg_type_number_t count;
+    vm_statistics64_data_t vm_stats;
+    kern_return_t kr;
+    struct xsw_usage swapusage;
+    raw_sample_t raw;
+    
+    /*
+     * Get VM statistics using Mach host_statistics64() API
+     * This is the Darwin/Mach way of getting memory statistics
+     * Unlike BSD sysctls, this uses Mach IPC
+     */
+    count = HOST_VM_INFO64_COUNT;
+    kr = host_statistics64(s->host, HOST_VM_INFO64,
+                          (host_info64_t)&vm_stats, &count);
+    if (kr != KERN_SUCCESS) {
+        return fail(EIO, "host_statistics64: %s", mach_error_string(kr));
+    }
+    
+    /*
+     * Paging counters come with the same host_statistics64() snapshot,
+     * so the one call answers every counter but the swap usage
+     */
+    memset(&raw, 0, sizeof(raw));
+    raw_set(&raw, DARWIN_PAGESIZE, pagesize);
+    raw_set(&raw, DARWIN_MEMSIZE, s->physmem);
+    raw_set(&raw, DARWIN_FREE_COUNT, vm_stats.free_count);
+    raw_set(&raw, DARWIN_ACTIVE_COUNT, vm_stats.active_count);
+    raw_set(&raw, DARWIN_INACTIVE_COUNT, vm_stats.inactive_count);
+    raw_set(&raw, DARWIN_WIRE_COUNT, vm_stats.wire_count);
+    raw_set(&raw, DARWIN_SPECULATIVE_COUNT, vm_stats.speculative_count);
+    raw_set(&raw, DARWIN_PURGEABLE_COUNT, vm_stats.purgeable_count);
+    raw_set(&raw, DARWIN_EXTERNAL_PAGE_COUNT, vm_stats.external_page_count);
+    raw_set(&raw, DARWIN_FREE_TARGET, s->free_target);
+    raw_set(&raw, DARWIN_SWAPINS, vm_stats.swapins);
+    raw_set(&raw, DARWIN_SWAPOUTS, vm_stats.swapouts);
+    raw_set(&raw, DARWIN_PAGEINS, vm_stats.pageins);
+    raw_set(&raw, DARWIN_PAGEOUTS, vm_stats.pageouts);
+    raw_set(&raw, DARWIN_COMPRESSIONS, vm_stats.compressions);
+    
+    /* --darwin-detail: the rest of the same snapshot, no extra Mach call */
+    if (s->flags & SAMPLER_DARWIN) {
+        darwin_detail_t *dd = &s->detail;
+        int level;
+        
+        dd->compressor = (uint64_t)vm_stats.compressor_page_count * pagesize;
+        dd->uncompressed = vm_stats.total_uncompressed_pages_in_compressor * pagesize;
+        dd->throttled = (uint64_t)vm_stats.throttled_count * pagesize;
+        dd->internal = (uint64_t)vm_stats.internal_page_count * pagesize;
+        dd->external = (uint64_t)vm_stats.external_page_count * pagesize;
+        dd->purgeable = (uint64_t)vm_stats.purgeable_count * pagesize;
+        dd->speculative = (uint64_t)vm_stats.speculative_count * pagesize;
+        dd->pageins = (uint64_t)vm_stats.pageins * pagesize;
+        dd->pageouts = (uint64_t)vm_stats.pageouts * pagesize;
+        dd->decompressions = (uint64_t)vm_stats.decompressions * pagesize;
+        dd->level = mib_read(&s->mib_memorystatus, &level, sizeof(level)) == 0 ? level : -1;
+    }
+    
+    /*
+     * Get swap usage from vm.swapusage sysctl
+     * macOS provides a structured xsw_usage with total/used/free in bytes;
+     * when it does not answer, swap might not be configured
+     */
+    if (mib_read(&s->mib_swapusage, &swapusage, sizeof(swapusage)) == 0) {
+        raw_set(&raw, DARWIN_XSU_TOTAL, swapusage.xsu_total);
+        raw_set(&raw, DARWIN_XSU_USED, swapusage.xsu_used);
+    }
+    
+    sample_compute(&raw, stats);
+    return 0;
+}
+#endif
+
+#if defined(__sun) || defined(__illumos__)
+/*
+ * illumos/Solaris Memory Statistics Retrieval
+ * 
+ * illumos is an open-source fork of OpenSolaris, and Solaris is the
+ * original Sun/Oracle operating system. Both share similar APIs.
+ * 
+ * Key differences from BSD systems:
+ * - Uses kstat (kernel statistics) library for memory info
+ * - Memory statistics from unix:0:system_pages kstat module
+ * - One kstat handle per sampler, refreshed via kstat_chain_update()
+ * - Swap information from swapctl() system call
+ * - Page size from sysconf(_SC_PAGESIZE)
+ * - No sysctl interface (different from BSD)
+ * 
+ * Memory calculation approach:
+ * - Total = physmem (total physical pages)
+ * - Free = freemem (immediately available pages)
+ * - Uses ZFS ARC as cache on illumos/Solaris
+ * - Kernel memory is "locked" (similar to wired on BSD)
+ * 
+ * Note: illumos/Solaris have sophisticated memory management with
+ * ZFS ARC (Adaptive Replacement Cache) which can use significant RAM.
+ */
+/*
+ * Index of a named statistic inside ks_data, or -1 if it is absent.
+ * The layout of a named kstat is fixed until the kstat chain changes,
+ * so later samples index ks_data directly instead of repeating the
+ * string compares in kstat_data_lookup().
+ */
+static int kstat_named_index(kstat_t *ksp, const char *name) {
+    kstat_named_t *knp = kstat_data_lookup(ksp, (char *)name);
+    
+    if (knp == NULL) {
+        return -1;
+    }
+    return (int)(knp - KSTAT_NAMED_PTR(ksp));
+}
+
+/* Fetch a cached named statistic; *idx is resolved on first use */
+static kstat_named_t *kstat_named_cached(kstat_t *ksp, int *idx, const char *name) {
+    if (*idx < 0) {
+        *idx = kstat_named_index(ksp, name);
+        if (*idx < 0) {
+            return NULL;
+        }
+    }
+    if ((unsigned int)*idx >= ksp->ks_ndata) {
+        return NULL;
+    }
+    return &KSTAT_NAMED_PTR(ksp)[*idx];
+}
+
+/*
+ * (Re)resolve the kstats used by every sample
+ * Called at init and whenever kstat_chain_update() reports that
+ * kstats were added or removed, since the old kstat_t pointers and
+ * data layouts may no longer be valid.
+ */
+static void sampler_lookup_arc(sampler_t *s) {
+    /*
+     * ZFS ARC statistics if available
+     * The ARC (Adaptive Replacement Cache) is ZFS's main cache
+     * and can consume a large portion of available memory
+     */
+    s->ksp_arc = kstat_lookup(s->kc_arc, "zfs", 0, "arcstats");
+    for (int i = 0; i < ARC_NFIELDS; i++) {
+        s->idx_arc[i] = -1;
+    }
+}
+
+static int sampler_lookup_kstats(sampler_t *s) {
+    /*
+     * Read memory statistics from unix:0:system_pages kstat
+     * This module contains system-wide page statistics
+     */
+    s->ksp_pages = kstat_lookup(s->kc_pages, "unix", 0, "system_pages");
+    if (s->ksp_pages == NULL) {
+        return fail(ENOENT, "kstat_lookup system_pages");
+    }
+    
+    s->idx_physmem = -1;
+    s->idx_freemem = -1;
+    s->idx_pp_kernel = -1;
+    s->idx_lotsfree = -1;
+    /* A --deadline worker with its own handle follows its own chain */
+    if (s->kc_arc == s->kc_pages) {
+        sampler_lookup_arc(s);
+    }
+    return 0;
+}
+
+/*
+ * Make room for n swap entries in the cached swap table
+ * The table and its path buffers survive across samples and are only
+ * reallocated when the number of swap devices changes. Each entry gets
+ * its own path buffer so SC_LIST does not overwrite one shared string.
+ */
+static int swap_table_reserve(sampler_t *s, int n) {
+    struct swapent *ste;
+    int i;
+    
+    if (n == s->swt_n) {
+        return 0;
+    }
+    
+    free(s->swt);
+    free(s->swt_paths);
+    s->swt = malloc(sizeof(int) + n * sizeof(struct swapent));
+    s->swt_paths = malloc((size_t)n * MAXPATHLEN);
+    if (s->swt == NULL || s->swt_paths == NULL) {
+        /* Sized again from scratch by the next sample */
+        free(s->swt);
+        free(s->swt_paths);
+        s->swt = NULL;
+        s->swt_paths = NULL;
+        s->swt_n = 0;
+        return fail(ENOMEM, "malloc");
+    }
+    s->swt_n = n;
+    
+    s->swt->swt_n = n;
+    ste = &(s->swt->swt_ent[0]);
+    for (i = 0; i < n; i++, ste++) {
+        ste->ste_path = s->swt_paths + (size_t)i * MAXPATHLEN;
+    }
+    return 0;
+}
+
+/*
+ * Find the partition I/O kstat of swap device path. /dev/dsk/c0t0d0s1
+ * is a link to /devices/<node>:<minor>; /etc/path_to_inst gives the
+ * driver and instance bound to <node>, and the kstat is then
+ * <driver>:<instance>:<driver><instance>,<minor> (sd:0:sd0,b), the
+ * partition iostat -p shows. Swap files and zvols have none and are
+ * left with an empty module.
+ */
+static void swap_io_resolve(const char *path, swap_io_kstat_t *k) {
+    char real[MAXPATHLEN], line[MAXPATHLEN + 64], driver[KSTAT_STRLEN];
+    char *minor, *end;
+    int instance;
+    FILE *f;
+    
+    snprintf(k->path, sizeof(k->path), "%s", path);
+    k->module[0] = '\0';
+    if (realpath(path, real) == NULL || strncmp(real, "/devices/", 9) != 0 ||
+        (minor = strrchr(real, ':')) == NULL) {
+        return;
+    }
+    *minor++ = '\0';
+    
+    /* Lines are "<node>" <instance> "<driver>"; only read when a device appears */
+    if ((f = fopen("/etc/path_to_inst", "r")) == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] != '"' || (end = strchr(line + 1, '"')) == NULL) {
+            continue;
+        }
+        *end = '\0';
+        if (strcmp(line + 1, real + 8) == 0 &&
+            sscanf(end + 1, " %d \"%30[^\"]\"", &instance, driver) == 2) {
+            /* A name too long for a kstat cannot be one */
+            int n = snprintf(k->name, sizeof(k->name), "%s%d,%s", driver, instance, minor);
+            if (n > 0 && (size_t)n < sizeof(k->name)) {
+                snprintf(k->module, sizeof(k->module), "%s", driver);
+                k->instance = instance;
+            }
+            break;
+        }
+    }
+    fclose(f);
+}
+
+/*
+ * Swap device I/O for SAMPLER_SWAP_IO from the partition kstats.
+ * kstat_io_t rtime is the time the partition had I/O in service.
+ */
+static int swap_io_kstats(sampler_t *s) {
+    kstat_io_t kio;
+    
+    /* Serially sample_vm() already brought the shared chain up to date */
+    if (s->kc_swap != s->kc_pages) {
+        kstat_chain_update(s->kc_swap);
+    }
+    if (s->swap_ndevs > s->swap_io_alloc) {
+        swap_io_kstat_t *io = realloc(s->swap_io, (size_t)s->swap_ndevs * sizeof(*io));
+        if (io == NULL) {
+            return fail(ENOMEM, "realloc");
+        }
+        memset(io + s->swap_io_alloc, 0,
+               (size_t)(s->swap_ndevs - s->swap_io_alloc) * sizeof(*io));
+        s->swap_io = io;
+        s->swap_io_alloc = s->swap_ndevs;
+    }
+    
+    for (int i = 0; i < s->swap_ndevs; i++) {
+        swap_dev_t *d = &s->swap_devs[i];
+        swap_io_kstat_t *k = &s->swap_io[i];
+        kstat_t *ksp;
+        
+        if (strcmp(k->path, d->name) != 0) {
+            swap_io_resolve(d->name, k);
+        }
+        d->has_io = 0;
+        if (k->module[0] == '\0' ||
+            (ksp = kstat_lookup(s->kc_swap, k->module, k->instance, k->name)) == NULL ||
+            ksp->ks_type != KSTAT_TYPE_IO || kstat_read(s->kc_swap, ksp, &kio) == -1) {
+            continue;
+        }
+        d->has_io = 1;
+        d->read_bytes = kio.nread;
+        d->write_bytes = kio.nwritten;
+        d->reads = kio.reads;
+        d->writes = kio.writes;
+        d->io_time_ns = (uint64_t)kio.rtime;
+    }
+    return 0;
+}
+
+/*
+ * Per-device swap totals from SC_LIST
+ * Matches `swap -l`: only disk and file swap devices are counted.
+ */
+static int swap_sample_devices(sampler_t *s, raw_sample_t *raw) {
+    struct swapent *ste;
+    uint64_t pages = 0, free_pages = 0;
+    int i, n, listed;
+    
+    s->swap_ndevs = 0;
+    
+    for (;;) {
+        n = swapctl(SC_GETNSWP, NULL);
+        if (n <= 0) {
+            /* No swap configured */
+            return 0;
+        }
+        if (swap_table_reserve(s, n) == -1) {
+            return -1;
+        }
+        
+        /* Get swap table entries */
+        listed = swapctl(SC_LIST, s->swt);
+        if (listed == -1 && errno == ENOMEM) {
+            /* A device was added between the two calls, size again */
+            continue;
+        }
+        if (listed == -1) {
+            return 0;
+        }
+        break;
+    }
+    
+    /* Sum up all swap devices */
+    if ((s->flags & SAMPLER_SWAP_DEVICES) && swap_devs_reserve(s, listed) == -1) {
+        return -1;
+    }
+    ste = &(s->swt->swt_ent[0]);
+    for (i = 0; i < listed; i++, ste++) {
+        uint64_t total = (uint64_t)ste->ste_pages * s->page_size;
+        uint64_t used = (uint64_t)(ste->ste_pages - ste->ste_free) * s->page_size;
+        
+        pages += (uint64_t)ste->ste_pages;
+        free_pages += (uint64_t)ste->ste_free;
+        if (s->flags & SAMPLER_SWAP_DEVICES) {
+            /* SC_LIST rewrites every path anyway, nothing to cache */
+            swap_dev_t *d = &s->swap_devs[i];
+            snprintf(d->name, sizeof(d->name), "%s", ste->ste_path);
+            d->total = total;
+            d->used = used;
+        }
+    }
+    s->swap_ndevs = (s->flags & SAMPLER_SWAP_DEVICES) ? listed : 0;
+    if ((s->flags & SAMPLER_SWAP_IO) && swap_io_kstats(s) == -1) {
+        return -1;
+    }
+    
+    raw_set(raw, ILLUMOS_SWAP_PAGES, pages);
+    raw_set(raw, ILLUMOS_SWAP_FREE, free_pages);
+    return 0;
+}
+
+/*
+ * Swap totals from a single SC_AINFO call (SAMPLER_SWAP_TOTALS)
+ * Cheaper than listing devices, but reports virtual swap like
+ * `swap -s`: the anon pool includes memory that can back swap.
+ */
+/*
+ * Virtual swap is the commit accounting: every anonymous page reserves
+ * ani_resv when it is mapped, and reservations fail past ani_max
+ */
+static void anon_commit(const sampler_t *s, const struct anoninfo *ai, raw_sample_t *raw) {
+    if (s->flags & SAMPLER_COMMIT) {
+        raw_set(raw, ILLUMOS_ANI_RESV, (uint64_t)ai->ani_resv);
+        raw_set(raw, ILLUMOS_ANI_MAX, (uint64_t)ai->ani_max);
+    }
+}
+
+static int swap_sample_totals(sampler_t *s, raw_sample_t *raw) {
+    struct anoninfo ai;
+    
+    if (swapctl(SC_AINFO, &ai) == -1) {
+        return 0;
+    }
+    
+    raw_set(raw, ILLUMOS_SWAP_PAGES, (uint64_t)ai.ani_max);
+    raw_set(raw, ILLUMOS_SWAP_FREE, (uint64_t)ai.ani_free);
+    anon_commit(s, &ai, raw);
+    return 0;
+}
+
+static int sampler_init(sampler_t *s, unsigned int flags) {
+    long page_size;
+    
+    memset(s, 0, sizeof(*s));
+    s->flags = flags;
+    
+    /*
+     * Get page size from sysconf
+     * Typically 4KB on x86, 8KB on SPARC
+     */
+    page_size = sysconf(_SC_PAGESIZE);
+    if (page_size == -1) {
+        return fail(errno, "sysconf _SC_PAGESIZE");
+    }
+    s->page_size = (uint64_t)page_size;
+    
+    /*
+     * Open kstat library to access kernel statistics
+     * kstat is the Solaris/illumos way to get kernel metrics.
+     * kstat_open() copies the whole kstat chain, so the handle is
+     * opened once and kept until sampler_destroy().
+     */
+    s->kc = kstat_open();
+    if (s->kc == NULL) {
+        return fail(errno, "kstat_open");
+    }
+    s->kc_pages = s->kc;
+    s->kc_arc = s->kc;
+    s->kc_swap = s->kc;
+    if (sampler_lookup_kstats(s) == -1) {
+        return -1;
+    }
+    
+    /* Probed once; a later chain update only moves the kstat_t */
+    s->has_arc = s->ksp_arc != NULL;
+    s->caps = CAP_SWAP | CAP_SWAP_DEVICES | CAP_SWAP_TOTALS | CAP_COMMIT | CAP_PARALLEL |
+              CAP_SWAP_IO;
+    if (s->has_arc) {
+        s->caps |= CAP_ARC;
+    }
+    return 0;
+}
+
+static void sampler_destroy(sampler_t *s) {
+    pool_destroy(s);
+    if (s->kc_pages != s->kc) {
+        kstat_close(s->kc_pages);
+    }
+    if (s->kc_arc != s->kc) {
+        kstat_close(s->kc_arc);
+    }
+    if (s->kc_swap != s->kc) {
+        kstat_close(s->kc_swap);
+    }
+    s->kc_pages = NULL;
+    s->kc_arc = NULL;
+    s->kc_swap = NULL;
+    if (s->kc != NULL) {
+        kstat_close(s->kc);
+        s->kc = NULL;
+    }
+    free(s->swt);
+    free(s->swt_paths);
+    free(s->swap_devs);
+    free(s->swap_io);
+    s->swt = NULL;
+    s->swt_paths = NULL;
+    s->swap_devs = NULL;
+    s->swap_io = NULL;
+    s->swt_n = 0;
+    s->swap_devs_alloc = 0;
+    s->swap_io_alloc = 0;
+    s->swap_ndevs = 0;
+}
+
+/*
+ * The three SOURCE_* reads of a sample, see the FreeBSD ones. libkstat
+ * handles are not thread-safe, so under --deadline the VM and cache
+ * sources each own a handle (kc_pages, kc_arc), as does the swap
+ * source when it reads I/O kstats (kc_swap), and s->kc stays with the
+ * main thread; serially they are all the same handle.
+ */
+static const uint32_t source_raw[SOURCE_COUNT] = {
+    RAW_RANGE(ILLUMOS_PHYSMEM, ILLUMOS_LOTSFREE),
+    RAW_RANGE(ILLUMOS_ARC, ILLUMOS_ARC + ARC_NBASE - 1),
+    RAW_RANGE(ILLUMOS_SWAP_PAGES, ILLUMOS_ANI_MAX),
+};
+
+static int sample_vm(sampler_t *s, raw_sample_t *raw, arc_stats_t *arc) {
+    kstat_named_t *knp;
+    
+    (void)arc;
+    
+    /*
+     * Only walk the chain again when kstats were added or removed
+     * (kstat_chain_update() returns 0 when nothing changed); a failed
+     * lookup leaves ksp_pages NULL and is retried by the next sample
+     */
+    if ((kstat_chain_update(s->kc_pages) != 0 || s->ksp_pages == NULL) &&
+        sampler_lookup_kstats(s) == -1) {
+        return -1;
+    }
+    
+    if (kstat_read(s->kc_pages, s->ksp_pages, NULL) == -1) {
+        /* The kstat may have gone away under us; resolve once more */
+        if (kstat_chain_update(s->kc_pages) == -1) {
+            return fail(errno, "kstat_chain_update");
+        }
+        if (sampler_lookup_kstats(s) == -1) {
+            return -1;
+        }
+        if (kstat_read(s->kc_pages, s->ksp_pages, NULL) == -1) {
+            return fail(errno, "kstat_read system_pages");
+        }
+    }
+    
+    /*
+     * Extract memory page counts from kstat
+     * - physmem: total physical memory pages
+     * - freemem: free memory pages
+     * - pp_kernel: pages used by kernel (locked)
+     */
+    knp = kstat_named_cached(s->ksp_pages, &s->idx_physmem, "physmem");
+    if (knp) raw_set(raw, ILLUMOS_PHYSMEM, knp->value.ul);
+    
+    knp = kstat_named_cached(s->ksp_pages, &s->idx_freemem, "freemem");
+    if (knp) raw_set(raw, ILLUMOS_FREEMEM, knp->value.ul);
+    
+    knp = kstat_named_cached(s->ksp_pages, &s->idx_pp_kernel, "pp_kernel");
+    if (knp) raw_set(raw, ILLUMOS_PP_KERNEL, knp->value.ul);
+    
+    /* The page scanner starts once freemem drops below lotsfree */
+    knp = kstat_named_cached(s->ksp_pages, &s->idx_lotsfree, "lotsfree");
+    if (knp) raw_set(raw, ILLUMOS_LOTSFREE, knp->value.ul);
+    return 0;
+}
+
+static int sample_cache(sampler_t *s, raw_sample_t *raw, arc_stats_t *arc) {
+    kstat_named_t *knp;
+    
+    if (s->kc_arc != s->kc_pages && kstat_chain_update(s->kc_arc) != 0) {
+        sampler_lookup_arc(s);
+    }
+    
+    /*
+     * ZFS ARC, read from the same persistent handle. One kstat_read()
+     * copies every arcstat, so the --arc breakdown costs no extra call.
+     */
+    arc->present = 0;
+    if (s->ksp_arc != NULL && kstat_read(s->kc_arc, s->ksp_arc, NULL) != -1) {
+        for (int i = 0; i < ARC_NFIELDS; i++) {
+            knp = kstat_named_cached(s->ksp_arc, &s->idx_arc[i], libfree_arc_names[i]);
+            if (knp) {
+                arc->v[i] = knp->value.ui64;
+                arc->present |= 1u << i;
+                if (i < ARC_NBASE) {
+                    raw_set(raw, ILLUMOS_ARC + i, arc->v[i]);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int sample_swap(sampler_t *s, raw_sample_t *raw, arc_stats_t *arc) {
+    (void)arc;
+    
+    /*
+     * Get swap information using swapctl()
+     * This is the illumos/Solaris way to query swap space
+     */
+    if ((s->flags & SAMPLER_SWAP_TOTALS) && !(s->flags & SAMPLER_SWAP_DEVICES)) {
+        return swap_sample_totals(s, raw);
+    }
+    
+    /* The totals path gets commit figures for free; SC_LIST has none */
+    if (s->flags & SAMPLER_COMMIT) {
+        struct anoninfo ai;
+        if (swapctl(SC_AINFO, &ai) != -1) {
+            anon_commit(s, &ai, raw);
+        }
+    }
+    return swap_sample_devices(s, raw);
+}
+
+int sampler_sample(sampler_t *s, mem_stats_t *stats) {
+    raw_sample_t raw;
+    
+    memset(&raw, 0, sizeof(raw));
+    if (s->pool != NULL) {
+        if (pool_sample(s, &raw) == -1) {
+            return -1;
+        }
+    } else if (sample_vm(s, &raw, NULL) == -1 || sample_cache(s, &raw, &s->arc) == -1 ||
+               sample_swap(s, &raw, NULL) == -1) {
+        return -1;
+    }
+    raw_set(&raw, ILLUMOS_PAGESIZE, s->page_size);
+    sample_compute(&raw, stats);
+    stats->stale = s->stale;
+    return 0;
+}
+#endif
+
+#ifdef __HAIKU__
+/*
+ * Haiku OS Memory Statistics Retrieval
+ * 
+ * Haiku is an open-source recreation of BeOS, with its own unique APIs.
+ * 
+ * Key differences from other systems:
+ * - Uses BeOS-style get_system_info() API
+ * - Returns system_info structure with memory statistics
+ * - Page size from B_PAGE_SIZE constant (typically 4KB)
+ * - Much simpler API than BSD sysctl or Solaris kstat
+ * - No traditional swap file (uses virtual memory differently)
+ * 
+ * Memory calculation approach:
+ * - Uses system_info structure from get_system_info()
+ * - max_pages: total physical memory pages
+ * - used_pages: pages currently in use
+ * - cached_pages: pages used for cache
+ * - page_faults: not used for memory stats
+ * 
+ * Note: Haiku's memory management is simpler and more BeOS-like
+ * than traditional Unix systems.
+ */
+static int sampler_init(sampler_t *s, unsigned int flags) {
+    memset(s, 0, sizeof(*s));
+    s->flags = flags;
+    s->page_size = B_PAGE_SIZE;
+    s->caps = CAP_CACHE_COUNT | CAP_COMMIT;
+    return 0;
+}
+
+static void sampler_destroy(sampler_t *s) {
+    (void)s;
+}
+
+int sampler_sample(sampler_t *s, mem_stats_t *stats) {
+    system_info sysinfo;
+    raw_sample_t raw;
+    
+    /*
+     * Get system information using Haiku's native API
+     * This is much simpler than BSD sysctl or Solaris kstat
+     */
+    if (get_system_info(&sysinfo) != B_OK) {
+        return fail(EIO, "get_system_info");
+    }
+    
+    /*
+     * Haiku system_info provides:
+     * - max_pages: total physical memory pages
+     * - used_pages: pages used by applications (NOT including cache)
+     * - cached_pages: pages used for file cache (separate from used_pages)
+     * - page_faults: not used for memory stats
+     * - ignored_pages: system reserved pages
+     */
+    memset(&raw, 0, sizeof(raw));
+    raw_set(&raw, HAIKU_PAGE_SIZE, B_PAGE_SIZE);
+    raw_set(&raw, HAIKU_MAX_PAGES, (uint64_t)sysinfo.max_pages);
+    raw_set(&raw, HAIKU_USED_PAGES, (uint64_t)sysinfo.used_pages);
+    raw_set(&raw, HAIKU_CACHED_PAGES, (uint64_t)sysinfo.cached_pages);
+    if (s->flags & SAMPLER_COMMIT) {
+        raw_set(&raw, HAIKU_NEEDED_MEMORY, (uint64_t)sysinfo.needed_memory);
+        raw_set(&raw, HAIKU_FREE_MEMORY, (uint64_t)sysinfo.free_memory);
+    }
+    sample_compute(&raw, stats);
+    
+    return 0;
+}
+#endif
+
+/*
+ * One-shot retrieval: resolve, sample and release in a single call.
+ * Continuous mode keeps a sampler_t alive across samples instead.
+ */
+int mem_stats_retrieve(mem_stats_t *stats) {
+    sampler_t sampler;
+    int ret, error;
+    
+    if (sampler_init(&sampler, 0) == 0) {
+        ret = sampler_sample(&sampler, stats);
+    } else {
+        ret = -1;
+    }
+    error = errno;
+    sampler_destroy(&sampler);
+    errno = error;
+    return ret;
+}
+
+/*
+ * Per-device swap rows from the latest sample (SAMPLER_SWAP_DEVICES)
+ * Returns the number of rows; 0 where devices cannot be enumerated.
+ */
+int sampler_swap_devices(const sampler_t *s, const swap_dev_t **devs) {
+#ifdef HAVE_PARALLEL
+    /*
+     * The rows are those of the swap source's last completed read;
+     * under --rate they would show no traffic, so a sample in which the
+     * source is stale has none
+     */
+    if (s->stale & (1u << SOURCE_SWAP)) {
+        *devs = NULL;
+        return 0;
+    }
+#endif
+#ifdef HAVE_SWAP_DEVICES
+    *devs = s->swap_devs;
+    return s->swap_ndevs;
+#else
+    (void)s;
+    *devs = NULL;
+    return 0;
+#endif
+}
+
+unsigned int sampler_caps(const sampler_t *s) {
+    return s->caps;
+}
+
+#if defined(__FreeBSD__)
+const backend_t libfree_backend = { "freebsd", "vm.stats sysctls",
+    CAP_SWAP | CAP_SWAP_DEVICES | CAP_PAGING | CAP_ARC | CAP_CACHE_COUNT | CAP_BUFSPACE |
+    CAP_COMMIT | CAP_PARALLEL | CAP_SWAP_IO };
+#elif defined(__NetBSD__)
+const backend_t libfree_backend = { "netbsd", "vm.uvmexp2",
+    CAP_SWAP | CAP_SWAP_DEVICES | CAP_PAGING | CAP_CACHE_COUNT | CAP_COMMIT | CAP_SNAPSHOT |
+    CAP_SWAP_IO };
+#elif defined(__OpenBSD__)
+const backend_t libfree_backend = { "openbsd", "vm.uvmexp",
+    CAP_SWAP | CAP_SWAP_DEVICES | CAP_PAGING | CAP_COMMIT | CAP_SNAPSHOT | CAP_SWAP_IO };
+#elif defined(__DragonFly__)
+const backend_t libfree_backend = { "dragonfly", "vm.stats sysctls",
+    CAP_SWAP | CAP_PAGING | CAP_CACHE_COUNT };
+#elif defined(__APPLE__)
+const backend_t libfree_backend = { "darwin", "host_statistics64",
+    CAP_SWAP | CAP_PAGING | CAP_CACHE_COUNT | CAP_DARWIN | CAP_PRESSURE };
+#elif defined(__sun) || defined(__illumos__)
+const backend_t libfree_backend = { "illumos", "kstat",
+    CAP_SWAP | CAP_SWAP_DEVICES | CAP_SWAP_TOTALS | CAP_ARC | CAP_COMMIT | CAP_PARALLEL |
+    CAP_SWAP_IO };
+#elif defined(__HAIKU__)
+const backend_t libfree_backend = { "haiku", "get_system_info",
+    CAP_CACHE_COUNT | CAP_COMMIT };
+#else
+const backend_t libfree_backend = { "unknown", "-", 0 };
+#endif
+
+/* ARC breakdown from the latest sample; NULL where there is no ZFS */
+const arc_stats_t *sampler_arc(const sampler_t *s) {
+#ifdef HAVE_ZFS_ARC
+    return s->has_arc ? &s->arc : NULL;
+#else
+    (void)s;
+    return NULL;
+#endif
+}
+
+#ifdef HAVE_PARALLEL
+/*
+ * --deadline: one worker thread per SOURCE_*, so a source stuck in the
+ * kernel holds up nobody else. sampler_sample() bumps the generation,
+ * waits until every source has answered it or the deadline passes, and
+ * takes the newest completed result of each. A late source keeps
+ * reading and publishes when it is done; the sample that missed it
+ * reuses its previous result and is marked stale. Only the first
+ * sample waits without a deadline, when there is nothing to reuse.
+ * A source whose read fails answers the generation with its errno and
+ * sampler_error() text, and that sample fails with them.
+ */
+typedef int (*source_fn_t)(sampler_t *s, raw_sample_t *raw, arc_stats_t *arc);
+
+typedef struct {
+    pool_t *pool;
+    source_fn_t fn;
+    sampler_t *s;           /* p->s, or the swap worker's own copy */
+    pthread_t thread;
+    uint64_t done;          /* generation the result answers */
+    int valid;              /* result holds a completed read */
+    int error;              /* errno of a failed read of generation done */
+    char what[128];         /* its sampler_error(), fail_what is per thread */
+    raw_sample_t result;    /* under pool->lock */
+    arc_stats_t arc;
+} source_t;
+
+struct pool {
+    sampler_t *s;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    /* workers: a new generation or stop */
+    pthread_cond_t answered;    /* sampler: a source published */
+    uint64_t gen;
+    int stop;
+    int nthreads;
+    struct timespec deadline;
+    source_t src[SOURCE_COUNT];
+    sampler_t swap;         /* see pool_swap_detach() */
+};
+
+static void *source_worker(void *arg) {
+    source_t *src = arg;
+    pool_t *p = src->pool;
+    raw_sample_t result;
+    arc_stats_t arc;
+    
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->stop && src->done == p->gen) {
+            pthread_cond_wait(&p->wake, &p->lock);
+        }
+        if (p->stop) {
+            break;
+        }
+        uint64_t gen = p->gen;
+        pthread_mutex_unlock(&p->lock);
+        
+        memset(&result, 0, sizeof(result));
+        memset(&arc, 0, sizeof(arc));
+        int rc = src->fn(src->s, &result, &arc);
+        int error = errno;
+        
+        pthread_mutex_lock(&p->lock);
+        if (rc == -1) {
+            /* The previous result, if any, stays for a later stale sample */
+            src->error = error;
+            snprintf(src->what, sizeof(src->what), "%s", fail_what);
+        } else {
+            src->error = 0;
+            src->result = result;
+            src->arc = arc;
+            src->valid = 1;
+        }
+        src->done = gen;
+        pthread_cond_signal(&p->answered);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* Copy the counters a source owns; source_raw[] ranges never overlap */
+static void source_merge(int id, raw_sample_t *dst, const raw_sample_t *r) {
+    uint32_t mask = source_raw[id];
+    
+    for (int i = 0; i < RAW_MAX; i++) {
+        if (mask & (1u << i)) {
+            dst->v[i] = r->v[i];
+        }
+    }
+    dst->present = (dst->present & ~mask) | (r->present & mask);
+}
+
+/*
+ * The swap source fills per-device rows and, on FreeBSD, a device
+ * table buffer, and on FreeBSD also writes the device index into its
+ * vm.swap_info MIB. Its worker therefore samples a copy of the sampler
+ * with buffers of its own, and pool_sample() copies the rows of a
+ * completed read out on the sampling thread: s->swap_devs is never
+ * written while a caller may be reading it.
+ */
+static void pool_swap_detach(sampler_t *w) {
+    w->pool = NULL;
+    w->swap_devs = NULL;
+    w->swap_devs_alloc = 0;
+    w->swap_ndevs = 0;
+#ifdef __FreeBSD__
+    w->io_buf = NULL;
+    w->io_size = 0;
+#else
+    w->swt = NULL;
+    w->swt_paths = NULL;
+    w->swt_n = 0;
+    w->swap_io = NULL;
+    w->swap_io_alloc = 0;
+#endif
+}
+
+static void pool_swap_free(sampler_t *w) {
+    free(w->swap_devs);
+#ifdef __FreeBSD__
+    free(w->io_buf);
+#else
+    free(w->swt);
+    free(w->swt_paths);
+    free(w->swap_io);
+#endif
+    pool_swap_detach(w);
+}
+
+static int pool_sample(sampler_t *s, raw_sample_t *raw) {
+    pool_t *p = s->pool;
+    struct timespec until;
+    long nsec;
+    
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    nsec = until.tv_nsec + p->deadline.tv_nsec;
+    until.tv_sec += p->deadline.tv_sec + nsec / 1000000000L;
+    until.tv_nsec = nsec % 1000000000L;
+    
+    pthread_mutex_lock(&p->lock);
+    p->gen++;
+    pthread_cond_broadcast(&p->wake);
+    for (;;) {
+        int waiting = 0, empty = 0;
+        for (int i = 0; i < SOURCE_COUNT; i++) {
+            waiting += p->src[i].done != p->gen;
+            empty += !p->src[i].valid && p->src[i].done != p->gen;
+        }
+        if (waiting == 0) {
+            break;
+        }
+        if (empty > 0) {
+            pthread_cond_wait(&p->answered, &p->lock);
+        } else if (pthread_cond_timedwait(&p->answered, &p->lock, &until) == ETIMEDOUT) {
+            break;
+        }
+    }
+    
+    for (int i = 0; i < SOURCE_COUNT; i++) {
+        source_t *src = &p->src[i];
+        if (src->done == p->gen && src->error != 0) {
+            int error = src->error;
+            snprintf(fail_what, sizeof(fail_what), "%s", src->what);
+            pthread_mutex_unlock(&p->lock);
+            errno = error;
+            return -1;
+        }
+    }
+    
+    s->stale = 0;
+    for (int i = 0; i < SOURCE_COUNT; i++) {
+        source_merge(i, raw, &p->src[i].result);
+        if (p->src[i].done != p->gen) {
+            s->stale |= 1u << i;
+        }
+    }
+    s->arc = p->src[SOURCE_CACHE].arc;
+    if (!(s->stale & (1u << SOURCE_SWAP))) {
+        /* The swap worker is idle until the next generation */
+        if (swap_devs_reserve(s, p->swap.swap_ndevs) == -1) {
+            pthread_mutex_unlock(&p->lock);
+            return -1;
+        }
+        if (p->swap.swap_ndevs > 0) {
+            memcpy(s->swap_devs, p->swap.swap_devs,
+                   (size_t)p->swap.swap_ndevs * sizeof(*s->swap_devs));
+        }
+        s->swap_ndevs = p->swap.swap_ndevs;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+/* Stop and join the workers; a worker stuck in the kernel is waited for */
+static void pool_destroy(sampler_t *s) {
+    pool_t *p = s->pool;
+    
+    if (p == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->nthreads; i++) {
+        pthread_join(p->src[i].thread, NULL);
+    }
+    pthread_cond_destroy(&p->wake);
+    pthread_cond_destroy(&p->answered);
+    pthread_mutex_destroy(&p->lock);
+    pool_swap_free(&p->swap);
+    free(p);
+    s->pool = NULL;
+}
+
+int sampler_parallel(sampler_t *s, double deadline) {
+    static const source_fn_t fns[SOURCE_COUNT] = { sample_vm, sample_cache, sample_swap };
+    pthread_condattr_t attr;
+    sigset_t all, old;
+    pool_t *p;
+    
+    p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return fail(ENOMEM, "calloc");
+    }
+#if defined(__sun) || defined(__illumos__)
+    /* The workers' own kstat handles, see sample_vm() */
+    kstat_ctl_t *kc[3] = { kstat_open(), kstat_open(), NULL };
+    if ((s->flags & SAMPLER_SWAP_IO) && kc[0] != NULL && kc[1] != NULL) {
+        kc[2] = kstat_open();
+    }
+    if (kc[0] == NULL || kc[1] == NULL || ((s->flags & SAMPLER_SWAP_IO) && kc[2] == NULL)) {
+        int error = errno;
+        for (int i = 0; i < 3; i++) {
+            if (kc[i] != NULL) {
+                kstat_close(kc[i]);
+            }
+        }
+        free(p);
+        return fail(error, "kstat_open");
+    }
+    s->kc_pages = kc[0];
+    s->kc_arc = kc[1];
+    if (kc[2] != NULL) {
+        s->kc_swap = kc[2];
+    }
+    /* A missing system_pages is retried by sample_vm() */
+    (void)sampler_lookup_kstats(s);
+    sampler_lookup_arc(s);
+#endif
+    p->s = s;
+    /* Copied once the handles above are open, see pool_swap_detach() */
+    p->swap = *s;
+    pool_swap_detach(&p->swap);
+    p->deadline.tv_sec = (time_t)deadline;
+    p->deadline.tv_nsec = (long)((deadline - (double)(time_t)deadline) * 1e9);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    /* The deadline is on the monotonic clock, like the -s schedule */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p->answered, &attr);
+    pthread_condattr_destroy(&attr);
+    s->pool = p;
+    
+    /* Signals stay with the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (int i = 0; i < SOURCE_COUNT; i++) {
+        p->src[i].pool = p;
+        p->src[i].fn = fns[i];
+        p->src[i].s = i == SOURCE_SWAP ? &p->swap : s;
+        int error = pthread_create(&p->src[i].thread, NULL, source_worker, &p->src[i]);
+        if (error != 0) {
+            /* Back to serial sampling, the handles above still serve it */
+            pthread_sigmask(SIG_SETMASK, &old, NULL);
+            pool_destroy(s);
+            return fail(error, "pthread_create");
+        }
+        p->nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return 0;
+}
+#else
+int sampler_parallel(sampler_t *s, double deadline) {
+    (void)s;
+    (void)deadline;
+    return fail(ENOTSUP, "--deadline");
+}
+#endif
+
+/* Darwin breakdown from the latest sample; NULL elsewhere */
+const darwin_detail_t *sampler_darwin(const sampler_t *s) {
+#ifdef __APPLE__
+    return (s->flags & SAMPLER_DARWIN) ? &s->detail : NULL;
+#else
+    (void)s;
+    return NULL;
+#endif
+}
+
+/*
+ * Derive used/available/buff-cache/swap-free from one sample
+ * Every output format goes through here so they agree on the numbers.
+ * A sample tagged with another backend's model (a fixture, another
+ * host's export) is derived by that backend's rules.
+ */
+void mem_derive(const mem_stats_t *stats, mem_derived_t *d) {
+    const model_t *m = &models[stats->model > MODEL_NATIVE && stats->model < MODEL_COUNT ?
+                               stats->model : MODEL_THIS];
+    
+    d->buff_cache = stats->mem_cache + stats->mem_buffers;
+    
+    if (m->uvm) {
+        /* NetBSD/OpenBSD: simpler calculation like their free command */
+        /* used = total - free (all non-free pages are considered "used") */
+        d->used = stats->mem_total - stats->mem_free;
+        /*
+         * available = free + cache (reclaimable memory)
+         * On NetBSD/OpenBSD, cache (file/exec pages) can be reclaimed when needed
+         * Don't include inactive here as it may overlap or not be immediately reclaimable
+         */
+        d->available = stats->mem_free + stats->mem_cache;
+    } else {
+        /*
+         * FreeBSD/Linux: used = total - available
+         * Only the reclaimable part of a ZFS ARC counts as available
+         */
+        d->available = stats->mem_free + stats->mem_inactive + stats->mem_cache -
+                       stats->arc_pinned;
+        d->used = stats->mem_total - d->available;
+    }
+    
+    d->available_fast = mem_estimate(stats, m->weights);
+    d->swap_free = stats->swap_total - stats->swap_used;
+}
+
+/*
+ * Memory that can be allocated without waiting on I/O: each class
+ * times its weight in percent. Free memory only counts above
+ * free_target, since dipping below it wakes the page daemon, and only
+ * the part of the cache an ARC would give back counts at all.
+ */
+uint64_t mem_estimate(const mem_stats_t *stats, const unsigned int *weights) {
+    uint64_t size[RECLAIM_NCLASSES];
+    uint64_t total = 0;
+    
+    size[RECLAIM_FREE] = stats->mem_free > stats->free_target ?
+                         stats->mem_free - stats->free_target : 0;
+    size[RECLAIM_INACTIVE] = stats->mem_inactive;
+    size[RECLAIM_LAUNDRY] = stats->mem_laundry;
+    size[RECLAIM_CACHE] = stats->mem_cache > stats->arc_pinned ?
+                          stats->mem_cache - stats->arc_pinned : 0;
+    size[RECLAIM_BUFFERS] = stats->mem_buffers;
+    
+    /* Divide first: 100 x a class of many TiB would overflow */
+    for (int i = 0; i < RECLAIM_NCLASSES; i++) {
+        total += size[i] / 100 * weights[i] + size[i] % 100 * weights[i] / 100;
+    }
+    return total;
+}
+
+/*
+ * Heap-allocated samplers for callers outside this file, which only
+ * see sampler_t as an opaque type
+ */
+sampler_t *sampler_open(unsigned int flags) {
+    sampler_t *s = malloc(sizeof(*s));
+    
+    if (s == NULL) {
+        fail(ENOMEM, "malloc");
+        return NULL;
+    }
+    if (sampler_init(s, flags) != 0) {
+        /* Every sampler_init() zeroes s first, so a partial one tears down */
+        int error = errno;
+        sampler_destroy(s);
+        free(s);
+        errno = error;
+        return NULL;
+    }
+    return s;
+}
+
+void sampler_close(sampler_t *s) {
+    if (s != NULL) {
+        sampler_destroy(s);
+        free(s);
+    }
+}
+
+unsigned int sampler_flags(const sampler_t *s) {
+    return s->flags;
+}
+
+#if defined(__sun) || defined(__illumos__)
+kstat_ctl_t *sampler_kstat(const sampler_t *s) {
+    return s->kc;
+}
+#endif
@@ -0,0 +1,345 @@
+/*
+ * libfree - the memory sampling behind free(1), as a library
+ * 
+ * A sampler_t keeps everything that does not change while the system
+ * runs (page size, physical memory, resolved sysctl MIBs, the kstat
+ * handle, the Mach host port) from sampler_open() to sampler_close().
+ * Programs that sample repeatedly should keep one open and call
+ * sampler_sample() on it; each call then only does the reads whose
+ * values move.
+ * 
+ *     sampler_t *s = sampler_open(0);
+ *     mem_stats_t st;
+ *     mem_derived_t d;
+ * 
+ *     memset(&st, 0, sizeof(st));
+ *     sampler_sample(s, &st);
+ *     mem_derive(&st, &d);
+ *     sampler_close(s);
+ * 
+ * The library never exits: when a kernel interface a backend cannot
+ * work without fails, sampler_open() returns NULL and sampler_sample()
+ * -1, with errno set and sampler_error() naming the call. Optional
+ * sources that are missing are reported by sampler_caps() instead. A sampler is not safe to share between threads without
+ * locking.
+ * 
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef LIBFREE_H
+#define LIBFREE_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__sun) || defined(__illumos__)
+#include <kstat.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint64_t mem_total;
+    uint64_t mem_free;
+    uint64_t mem_active;
+    uint64_t mem_inactive;
+    uint64_t mem_wired;
+    uint64_t mem_cache;
+    uint64_t mem_buffers;
+    uint64_t arc_pinned;    /* part of mem_cache the ARC will not give back */
+    uint64_t mem_laundry;   /* dirty, queued for writeback (FreeBSD) */
+    uint64_t free_target;   /* free memory the page daemon keeps, 0 if unknown */
+    unsigned int has_estimate_info; /* ESTIMATE_* bits for the above */
+    uint64_t swap_total;
+    uint64_t swap_used;
+    int has_swap_info;  /* 1 if swap info available, 0 otherwise */
+    
+    /* Cumulative paging traffic since boot, in bytes */
+    uint64_t swap_in;       /* read back from swap */
+    uint64_t swap_out;      /* written to swap */
+    uint64_t page_in;       /* all page-ins, file-backed included (Mach) */
+    uint64_t page_out;      /* all page-outs (Mach) */
+    uint64_t compressions;  /* handed to the memory compressor (Mach) */
+    unsigned int has_paging_info;   /* PAGING_* bits for the above */
+    
+    /* --committed: memory promised to processes (SAMPLER_COMMIT) */
+    uint64_t committed;     /* reserved for anonymous memory */
+    uint64_t commit_limit;  /* most the kernel will reserve */
+    uint64_t swap_only;     /* swapped out with no copy in RAM (UVM) */
+    unsigned int has_commit_info;   /* COMMIT_* bits for the above */
+    
+    unsigned int stale;     /* SOURCE_* bits reused from an earlier sample */
+    unsigned int model;     /* MODEL_* whose rules derive it, see mem_derive() */
+} mem_stats_t;
+
+/*
+ * The backend a sample was computed by. Samplers tag it with this
+ * build's backend and replayed fixtures with the backend that recorded
+ * them, so mem_derive() and mem_estimate()'s default weights follow
+ * that backend on any host, also across --export, --record and
+ * --agent. MODEL_NATIVE, as in a zeroed mem_stats_t, means this
+ * build's own backend.
+ */
+enum {
+    MODEL_NATIVE,
+    MODEL_FREEBSD,
+    MODEL_NETBSD,
+    MODEL_OPENBSD,
+    MODEL_DRAGONFLY,
+    MODEL_DARWIN,
+    MODEL_ILLUMOS,
+    MODEL_HAIKU,
+    MODEL_COUNT
+};
+
+#define PAGING_SWAP     0x01    /* swap_in, swap_out */
+#define PAGING_FILE     0x02    /* page_in, page_out */
+#define PAGING_COMPRESS 0x04    /* compressions */
+
+#define COMMIT_RESERVED 0x01    /* committed */
+#define COMMIT_LIMIT    0x02    /* commit_limit, enforced by the kernel */
+#define COMMIT_SWAPONLY 0x04    /* swap_only */
+
+#define ESTIMATE_ARC_PINNED  0x01   /* arc_pinned, ZFS in use */
+#define ESTIMATE_LAUNDRY     0x02   /* mem_laundry */
+#define ESTIMATE_FREE_TARGET 0x04   /* free_target */
+
+/*
+ * Independent sources of one sample, read concurrently under --deadline;
+ * a source that misses the deadline keeps its last value and its bit
+ * is set in mem_stats_t.stale
+ */
+#define SOURCE_VM    0      /* page counts */
+#define SOURCE_CACHE 1      /* ZFS ARC or page cache, buffers */
+#define SOURCE_SWAP  2      /* swap totals and devices, paging counters */
+#define SOURCE_COUNT 3
+
+extern const char *const libfree_source_names[SOURCE_COUNT];
+
+/* Values derived from one mem_stats_t sample, see mem_derive() */
+typedef struct {
+    uint64_t used;
+    uint64_t available;
+    uint64_t available_fast;    /* mem_estimate() with libfree_reclaim_weights[] */
+    uint64_t buff_cache;
+    uint64_t swap_free;
+} mem_derived_t;
+
+/*
+ * Classes of memory mem_estimate() weighs, in percent, by how soon the
+ * kernel can hand them out again: free memory at once, clean pages
+ * after an eviction pass, dirty ones only after a write to disk.
+ * libfree_reclaim_weights[] are this platform's defaults; pass another table
+ * to mem_estimate() to plug in a different model.
+ */
+enum {
+    RECLAIM_FREE,           /* mem_free above free_target */
+    RECLAIM_INACTIVE,
+    RECLAIM_LAUNDRY,
+    RECLAIM_CACHE,          /* mem_cache less arc_pinned */
+    RECLAIM_BUFFERS,
+    RECLAIM_NCLASSES
+};
+
+extern const unsigned int libfree_reclaim_weights[RECLAIM_NCLASSES];
+
+/* Platforms that can enumerate individual swap devices */
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || \
+    defined(__sun) || defined(__illumos__)
+#define HAVE_SWAP_DEVICES 1
+#endif
+
+/* One swap device, as listed by --swap-devices */
+typedef struct {
+    char name[128];
+    uint64_t id;            /* platform device id, used to cache name */
+    uint64_t total;
+    uint64_t used;
+    /*
+     * I/O counters since boot of the partition or disk the device is
+     * on (SAMPLER_SWAP_IO); has_io is 0 where none could be matched
+     */
+    int has_io;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t io_time_ns;    /* summed operation times, or busy time */
+} swap_dev_t;
+
+/* sampler_open() flags */
+#define SAMPLER_SWAP_TOTALS  0x01  /* swap totals only, no per-device walk */
+#define SAMPLER_SWAP_DEVICES 0x02  /* keep per-device swap rows */
+#define SAMPLER_ARC          0x04  /* read every libfree_arc_names[] field */
+#define SAMPLER_DARWIN       0x08  /* keep the darwin_detail_t breakdown */
+#define SAMPLER_COMMIT       0x10  /* fill the committed/commit_limit fields */
+#define SAMPLER_SNAPSHOT     0x20  /* derive every field from one kernel snapshot */
+#define SAMPLER_SWAP_IO      0x40  /* per-device I/O, with SAMPLER_SWAP_DEVICES */
+
+/*
+ * Sampler capabilities (sampler_caps())
+ * sampler_open() probes every optional source once and records what
+ * it found here; samples never retry a source that was missing then.
+ */
+#define CAP_SWAP            0x0001  /* swap totals */
+#define CAP_SWAP_DEVICES    0x0002  /* per-device swap rows */
+#define CAP_SWAP_TOTALS     0x0004  /* single-call virtual swap totals */
+#define CAP_PAGING          0x0008  /* PAGING_* counters */
+#define CAP_ARC             0x0010  /* ZFS ARC as cache */
+#define CAP_CACHE_COUNT     0x0020  /* page cache counter */
+#define CAP_BUFSPACE        0x0040  /* buffer cache size */
+#define CAP_COMMIT          0x0080  /* committed memory (SAMPLER_COMMIT) */
+#define CAP_DARWIN          0x0100  /* Mach detail (SAMPLER_DARWIN) */
+#define CAP_PRESSURE        0x0200  /* kernel memory pressure level */
+#define CAP_PARALLEL        0x0400  /* sources on worker threads (--deadline) */
+#define CAP_SNAPSHOT        0x0800  /* one-snapshot sampling (SAMPLER_SNAPSHOT) */
+#define CAP_SWAP_IO         0x1000  /* per-device swap I/O (SAMPLER_SWAP_IO) */
+#define CAP_COUNT           13
+
+extern const char *const libfree_cap_names[CAP_COUNT];   /* by CAP_* bit */
+
+/*
+ * One backend per platform, chosen at build time, behind
+ * sampler_open() / sampler_sample() / sampler_close() /
+ * sampler_caps(); this says which backend the build has and every
+ * CAP_* it can ever report.
+ */
+typedef struct {
+    const char *name;
+    const char *source;     /* primary kernel interface */
+    unsigned int caps;      /* CAP_* the backend can ever report */
+} backend_t;
+
+extern const backend_t libfree_backend;
+
+/*
+ * --darwin-detail: the rest of the host_statistics64() snapshot plus
+ * kern.memorystatus_level. Cumulative counters are in bytes.
+ */
+typedef struct {
+    uint64_t compressor;    /* physical memory holding compressed pages */
+    uint64_t uncompressed;  /* what those pages expand to */
+    uint64_t throttled;
+    uint64_t internal;      /* anonymous */
+    uint64_t external;      /* file-backed */
+    uint64_t purgeable;
+    uint64_t speculative;
+    uint64_t pageins;
+    uint64_t pageouts;
+    uint64_t decompressions;
+    int level;              /* memorystatus level: % of memory free, or -1 */
+} darwin_detail_t;
+
+/* Platforms whose cache figure is the ZFS ARC */
+#if defined(__FreeBSD__) || defined(__sun) || defined(__illumos__)
+#define HAVE_ZFS_ARC 1
+#endif
+
+/*
+ * Platforms whose sources can stall under load (a kstat chain read, the
+ * arcstats sysctls while the ARC resizes) and are split into SOURCE_*
+ * functions that --deadline runs on worker threads
+ */
+#if defined(__FreeBSD__) || defined(__sun) || defined(__illumos__)
+#define HAVE_PARALLEL 1
+#endif
+
+/*
+ * ZFS ARC breakdown (--arc), indexed by ARC_* in libfree_arc_names[] order.
+ * Both FreeBSD (kstat.zfs.misc.arcstats.<name>) and illumos
+ * (zfs:0:arcstats) export OpenZFS' arcstats under these names.
+ */
+enum {
+    ARC_SIZE,
+    ARC_C_MIN,
+    ARC_MRU_EVICT_DATA,
+    ARC_MRU_EVICT_META,
+    ARC_MFU_EVICT_DATA,
+    ARC_MFU_EVICT_META,
+    ARC_NBASE,              /* fields above are what mem_arc_pinned() uses */
+    ARC_C = ARC_NBASE,
+    ARC_C_MAX,
+    ARC_MRU_SIZE,
+    ARC_MFU_SIZE,
+    ARC_METADATA_SIZE,
+    ARC_COMPRESSED_SIZE,
+    ARC_UNCOMPRESSED_SIZE,
+    ARC_HITS,
+    ARC_MISSES,
+    ARC_NFIELDS
+};
+
+typedef struct {
+    uint64_t v[ARC_NFIELDS];
+    uint32_t present;       /* bit i set if v[i] was read */
+} arc_stats_t;
+
+#ifdef HAVE_ZFS_ARC
+extern const char *const libfree_arc_names[ARC_NFIELDS];
+#endif
+
+/* Opaque; see sampler_open() */
+typedef struct sampler sampler_t;
+
+/*
+ * sampler_open() probes every source once and returns NULL if the
+ * backend cannot sample at all; flags are SAMPLER_* bits.
+ * sampler_sample() leaves fields the platform does not provide
+ * untouched, so zero *stats first. Returns 0 on success, -1 with
+ * errno set on failure; the sampler stays usable and the next call
+ * tries again. Under sampler_parallel() a source whose read fails
+ * fails the sample it answers. sampler_parallel() returns -1 with
+ * ENOTSUP where there is no --deadline pool.
+ */
+sampler_t *sampler_open(unsigned int flags);
+int sampler_sample(sampler_t *s, mem_stats_t *stats);
+void sampler_close(sampler_t *s);
+
+unsigned int sampler_flags(const sampler_t *s);
+unsigned int sampler_caps(const sampler_t *s);
+int sampler_swap_devices(const sampler_t *s, const swap_dev_t **devs);
+const arc_stats_t *sampler_arc(const sampler_t *s);
+const darwin_detail_t *sampler_darwin(const sampler_t *s);
+int sampler_parallel(sampler_t *s, double deadline);
+
+/* The call behind the calling thread's last -1 or NULL, e.g. "sysctl vm.stats.vm.v_free_count" */
+const char *sampler_error(void);
+
+/* Kernel calls made by all samplers so far, for benchmarks */
+unsigned long sampler_kernel_calls(void);
+
+/*
+ * Fixtures: the raw kernel counters of a run of samples, in a text
+ * file. After fixture_record(), every sample any sampler takes is also
+ * appended to the file. fixture_replay() loads a fixture recorded by
+ * any backend, on any host, and returns how many samples it holds;
+ * fixture_sample() then computes them in turn, repeating the last one
+ * once they run out, and tags each with the recording backend's
+ * MODEL_*. Both return -1 with errno set on failure, EINVAL for a file
+ * that is not a fixture. fixture_close() ends either mode.
+ */
+int fixture_record(const char *path);
+int fixture_replay(const char *path);
+int fixture_sample(mem_stats_t *stats);
+void fixture_close(void);
+
+/* One sample without keeping a sampler: open, sample and close */
+int mem_stats_retrieve(mem_stats_t *stats);
+
+void mem_derive(const mem_stats_t *stats, mem_derived_t *d);
+uint64_t mem_estimate(const mem_stats_t *stats, const unsigned int *weights);
+uint64_t mem_arc_pinned(const arc_stats_t *arc);
+
+#if defined(__sun) || defined(__illumos__)
+/* The sampler's kstat handle, for further kstats on the same chain */
+kstat_ctl_t *sampler_kstat(const sampler_t *s);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBFREE_H */